@@ -296,6 +296,54 @@ yaml_emitter_emit(yaml_emitter_t *emitter, yaml_event_t *event)
     return 1;
 }
 
+/*
+ * Emit an event using the caller's hints instead of lookahead.
+ */
+
+YAML_DECLARE(int)
+yaml_emitter_emit_hinted(yaml_emitter_t *emitter, yaml_event_t *event,
+        int empty, const yaml_scalar_analysis_t *analysis)
+{
+    int result;
+
+    if (!QUEUE_EMPTY(emitter, emitter->events))
+        return yaml_emitter_emit(emitter, event);
+
+    emitter->hint.event = event;
+    emitter->hint.empty = empty;
+    emitter->hint.analysis = analysis;
+
+    result = (yaml_emitter_analyze_event(emitter, event)
+            && yaml_emitter_state_machine(emitter, event));
+
+    emitter->hint.event = NULL;
+    emitter->hint.empty = 0;
+    emitter->hint.analysis = NULL;
+    yaml_event_delete(event);
+
+    return result;
+}
+
+/*
+ * Analyze a scalar value so that it may be passed to yaml_emitter_emit_hinted().
+ */
+
+YAML_DECLARE(int)
+yaml_emitter_analyze_scalar_value(yaml_emitter_t *emitter,
+        yaml_char_t *value, size_t length, yaml_scalar_analysis_t *analysis)
+{
+    if (!yaml_emitter_analyze_scalar(emitter, value, length))
+        return 0;
+
+    analysis->multiline = emitter->scalar_data.multiline;
+    analysis->flow_plain_allowed = emitter->scalar_data.flow_plain_allowed;
+    analysis->block_plain_allowed = emitter->scalar_data.block_plain_allowed;
+    analysis->single_quoted_allowed = emitter->scalar_data.single_quoted_allowed;
+    analysis->block_allowed = emitter->scalar_data.block_allowed;
+
+    return 1;
+}
+
 /*
  * Check if we need to accumulate more events before emitting.
  *
@@ -1120,6 +1168,10 @@ yaml_emitter_check_empty_document(SHIM(yaml_emitter_t *emitter))
 static int
 yaml_emitter_check_empty_sequence(yaml_emitter_t *emitter)
 {
+    if (emitter->hint.event)
+        return (emitter->hint.event->type == YAML_SEQUENCE_START_EVENT
+                && emitter->hint.empty);
+
     if (emitter->events.tail - emitter->events.head < 2)
         return 0;
 
@@ -1134,6 +1186,10 @@ yaml_emitter_check_empty_sequence(yaml_emitter_t *emitter)
 static int
 yaml_emitter_check_empty_mapping(yaml_emitter_t *emitter)
 {
+    if (emitter->hint.event)
+        return (emitter->hint.event->type == YAML_MAPPING_START_EVENT
+                && emitter->hint.empty);
+
     if (emitter->events.tail - emitter->events.head < 2)
         return 0;
 
@@ -1148,7 +1204,8 @@ yaml_emitter_check_empty_mapping(yaml_emitter_t *emitter)
 static int
 yaml_emitter_check_simple_key(yaml_emitter_t *emitter)
 {
-    yaml_event_t *event = emitter->events.head;
+    yaml_event_t *event = (emitter->hint.event ? emitter->hint.event
+            : emitter->events.head);
     size_t length = 0;
 
     switch (event->type)
@@ -1732,6 +1789,21 @@ yaml_emitter_analyze_event(yaml_emitter_t *emitter,
                 if (!yaml_emitter_analyze_tag(emitter, event->data.scalar.tag))
                     return 0;
             }
+            if (emitter->hint.analysis) {
+                emitter->scalar_data.value = event->data.scalar.value;
+                emitter->scalar_data.length = event->data.scalar.length;
+                emitter->scalar_data.multiline =
+                    emitter->hint.analysis->multiline;
+                emitter->scalar_data.flow_plain_allowed =
+                    emitter->hint.analysis->flow_plain_allowed;
+                emitter->scalar_data.block_plain_allowed =
+                    emitter->hint.analysis->block_plain_allowed;
+                emitter->scalar_data.single_quoted_allowed =
+                    emitter->hint.analysis->single_quoted_allowed;
+                emitter->scalar_data.block_allowed =
+                    emitter->hint.analysis->block_allowed;
+                return 1;
+            }
             if (!yaml_emitter_analyze_scalar(emitter,
                         event->data.scalar.value, event->data.scalar.length))
                 return 0;
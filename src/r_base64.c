@@ -0,0 +1,177 @@
+#include "r_ext.h"
+
+/* Base64 encoding and decoding for !!binary scalars (RFC 2045 alphabet) */
+
+#define BAD 0x80
+#define WS  0x81
+#define PAD 0x82
+
+static const char Ryaml_base64_alphabet[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const unsigned char Ryaml_base64_values[256] = {
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,  WS,  WS, BAD, BAD,  WS, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+   WS, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,  62, BAD, BAD, BAD,  63,
+   52,  53,  54,  55,  56,  57,  58,  59,  60,  61, BAD, BAD, BAD, PAD, BAD, BAD,
+  BAD,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,
+   15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, BAD, BAD, BAD, BAD, BAD,
+  BAD,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,
+   41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD,
+  BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD, BAD
+};
+
+/* Return the size of the encoding of len bytes, including line breaks */
+size_t Ryaml_base64_encoded_size(size_t len)
+{
+  size_t chars = (len + 2) / 3 * 4;
+
+  return chars + (chars + BASE64_LINE_LENGTH - 1) / BASE64_LINE_LENGTH;
+}
+
+/* Encode len bytes of src into dst, which must be able to hold
+ * Ryaml_base64_encoded_size(len) characters. Every line, including the last,
+ * ends with a newline. Returns the number of characters written. */
+size_t Ryaml_base64_encode(const unsigned char *src, size_t len, char *dst)
+{
+  char *out = dst;
+  size_t i = 0, col = 0;
+  uint32_t v = 0;
+
+  for (i = 0; i + 3 <= len; i += 3) {
+    v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i + 1] << 8) | src[i + 2];
+    out[0] = Ryaml_base64_alphabet[v >> 18];
+    out[1] = Ryaml_base64_alphabet[(v >> 12) & 0x3F];
+    out[2] = Ryaml_base64_alphabet[(v >> 6) & 0x3F];
+    out[3] = Ryaml_base64_alphabet[v & 0x3F];
+    out += 4;
+
+    col += 4;
+    if (col == BASE64_LINE_LENGTH) {
+      *out++ = '\n';
+      col = 0;
+    }
+  }
+
+  if (i < len) {
+    v = (uint32_t)src[i] << 16;
+    if (i + 1 < len) {
+      v |= (uint32_t)src[i + 1] << 8;
+    }
+    out[0] = Ryaml_base64_alphabet[v >> 18];
+    out[1] = Ryaml_base64_alphabet[(v >> 12) & 0x3F];
+    out[2] = i + 1 < len ? Ryaml_base64_alphabet[(v >> 6) & 0x3F] : '=';
+    out[3] = '=';
+    out += 4;
+    col += 4;
+  }
+
+  if (col > 0) {
+    *out++ = '\n';
+  }
+
+  return out - dst;
+}
+
+/* Return the number of bytes that len characters of base64 decode to */
+size_t Ryaml_base64_decoded_size(const char *src, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)src;
+  size_t i = 0, chars = 0;
+
+  for (i = 0; i < len; i++) {
+    if (Ryaml_base64_values[p[i]] < 64) {
+      chars++;
+    }
+  }
+
+  return chars / 4 * 3 + (chars % 4 == 0 ? 0 : chars % 4 - 1);
+}
+
+/* Decode len characters of src into dst, which must be able to hold
+ * len / 4 * 3 + 3 bytes. Whitespace is ignored and padding is optional.
+ * Returns 1 on success and sets *dst_len, or 0 if src isn't valid base64. */
+int Ryaml_base64_decode(const char *src, size_t len, unsigned char *dst, size_t *dst_len)
+{
+  const unsigned char *p = (const unsigned char *)src, *end = p + len;
+  unsigned char *out = dst, a = 0, b = 0, c = 0, d = 0, value = 0;
+  uint32_t quad = 0;
+  int n = 0;
+
+  while (p < end) {
+    /* Fast path: whole groups of four alphabet characters */
+    if (n == 0) {
+      while (end - p >= 4) {
+        a = Ryaml_base64_values[p[0]];
+        b = Ryaml_base64_values[p[1]];
+        c = Ryaml_base64_values[p[2]];
+        d = Ryaml_base64_values[p[3]];
+        if ((a | b | c | d) & 0x80) {
+          break;
+        }
+        quad = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | d;
+        out[0] = quad >> 16;
+        out[1] = (quad >> 8) & 0xFF;
+        out[2] = quad & 0xFF;
+        out += 3;
+        p += 4;
+      }
+      if (p == end) {
+        break;
+      }
+    }
+
+    value = Ryaml_base64_values[*p++];
+    if (value == WS) {
+      continue;
+    }
+    else if (value == PAD) {
+      /* Only padding and whitespace may follow */
+      for (; p < end; p++) {
+        value = Ryaml_base64_values[*p];
+        if (value != PAD && value != WS) {
+          return 0;
+        }
+      }
+      break;
+    }
+    else if (value == BAD) {
+      return 0;
+    }
+
+    quad = (quad << 6) | value;
+    n++;
+    if (n == 4) {
+      out[0] = quad >> 16;
+      out[1] = (quad >> 8) & 0xFF;
+      out[2] = quad & 0xFF;
+      out += 3;
+      quad = 0;
+      n = 0;
+    }
+  }
+
+  switch (n) {
+    case 1:
+      return 0;
+
+    case 2:
+      *out++ = (quad >> 4) & 0xFF;
+      break;
+
+    case 3:
+      *out++ = (quad >> 10) & 0xFF;
+      *out++ = (quad >> 2) & 0xFF;
+      break;
+  }
+
+  *dst_len = out - dst;
+  return 1;
+}
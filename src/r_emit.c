@@ -3,14 +3,166 @@
 extern SEXP Ryaml_TagSymbol;
 extern SEXP Ryaml_QuotedSymbol;
 extern SEXP Ryaml_DeparseFunc;
-extern char Ryaml_error_msg[ERROR_MSG_SIZE];
+extern SEXP Ryaml_CatFunc;
+
+#define STYLE_CACHE_INITIAL_SIZE 64
+#define STYLE_CACHE_MAX_SIZE 65536
+#define ROW_BLOCK_SIZE 1024
+#define FORMAT_CHUNK_SIZE 16384
+#define PARALLEL_LIST_MIN_LENGTH 1024
+#define EMIT_STACK_INITIAL_SIZE 32
+#define ANCHOR_TABLE_INITIAL_SIZE 256
+#define ANCHOR_BUF_SIZE 16
 
 typedef struct {
   char *buffer;
   size_t size;
   size_t capa;
+
+  /* When set, output is written to a connection as the emitter flushes it
+   * instead of being collected in the buffer above */
+  SEXP s_call;
 } s_emitter_output;
 
+typedef struct {
+  SEXP s_chr;
+  yaml_scalar_style_t style;
+  yaml_scalar_analysis_t analysis;
+} s_style_entry;
+
+typedef struct {
+  SEXP s_obj;
+  int count;
+  int id;
+} s_anchor_entry;
+
+typedef struct {
+  yaml_break_t line_sep;
+  int indent;
+  int omap;
+  int column_major;
+  int unicode;
+  int precision;
+  int indent_mapping_sequence;
+  int flow_vectors; /* minimum length of a flow style vector, or -1 */
+  int anchors;
+  int threads;
+} s_emitter_options;
+
+/* An event recorded for emitting later, along with its hints */
+typedef struct {
+  yaml_event_t event;
+  int empty;
+  int has_analysis;
+  yaml_scalar_analysis_t analysis;
+} s_recorded_event;
+
+typedef struct {
+  s_recorded_event *events;
+  size_t count;
+  size_t capa;
+} s_event_log;
+
+/* Part of a large top-level list that is emitted on its own thread: events
+ * first..last-1 of the log, inside a copy of the list's start event */
+typedef struct {
+  yaml_emitter_t emitter;
+  s_emitter_output output;
+  size_t first;
+  size_t last;
+  int is_first;
+  int is_last;
+  int status;
+} s_emit_chunk;
+
+typedef struct {
+  yaml_emitter_t *emitter;
+  yaml_event_t *event;
+  s_event_log *log; /* events are recorded here instead when set */
+  int omap;
+  int column_major;
+  int precision;
+  int flow_vectors; /* minimum length of a flow style vector, or -1 */
+  int threads;
+  SEXP s_handlers;
+  s_error_context *error_ctx;
+
+  /* Scalar styles of the strings emitted so far, keyed by CHARSXP. The
+   * CHARSXPs are also stored in s_style_keys, so that none of them can be
+   * garbage collected (and its address reused) while emitting. */
+  s_style_entry *styles;
+  size_t styles_size;
+  size_t styles_count;
+  SEXP s_style_keys;
+  PROTECT_INDEX style_keys_index;
+
+  /* Number of times each list or vector occurs in the object being emitted,
+   * keyed by SEXP, when anchors are enabled. All of the keys are reachable
+   * from the object, so they don't need protecting. */
+  s_anchor_entry *anchors;
+  size_t anchors_size;
+  size_t anchors_count;
+  int last_anchor_id;
+} s_emitter_context;
+
+/* Formatted values of part of a real, integer or logical vector. Value i is
+ * buffer[offsets[i]] up to buffer[offsets[i + 1]]. Slabs are filled by
+ * worker threads, so they use malloc instead of R_alloc. */
+typedef struct {
+  char *buffer;
+  size_t capa;
+  size_t *offsets;
+  int count;
+} s_format_slab;
+
+typedef enum {
+  COLUMN_REAL,
+  COLUMN_INT,
+  COLUMN_LOGICAL,
+  COLUMN_STRING,
+  COLUMN_FACTOR,
+  COLUMN_OTHER
+} e_column_kind;
+
+/* A data.frame column being emitted row by row */
+typedef struct {
+  e_column_kind kind;
+  SEXP s_column;
+  SEXP s_key;
+  yaml_scalar_style_t key_style;
+  yaml_scalar_analysis_t key_analysis;
+
+  /* Formatted values for the current block of rows, for numeric and logical
+   * columns */
+  int type;
+  const void *data;
+  s_format_slab slab;
+} s_row_column;
+
+typedef enum {
+  FRAME_NONE,
+  FRAME_SEQ,
+  FRAME_MAP,
+  FRAME_OMAP,
+  FRAME_OMAP_PAIR
+} e_frame_kind;
+
+/* A list whose elements are being emitted */
+typedef struct {
+  e_frame_kind kind;
+  SEXP s_obj;
+  int index;
+  int length;
+} s_emit_frame;
+
+typedef struct {
+  s_emit_frame *frames;
+  int depth;
+  int size;
+  SEXP s_objs;
+  PROTECT_INDEX s_objs_index;
+} s_emit_stack;
+
 #if R_VERSION < R_Version(4, 5, 0)
 
 # define R_ClosureFormals(x) FORMALS(x)
@@ -91,124 +243,204 @@ static SEXP Ryaml_deparse_function(SEXP s_obj)
   return s_result;
 }
 
-/* Format a vector of reals for emitting */
-static SEXP Ryaml_format_real(SEXP s_obj, int precision)
+/* Format a finite real into str using the fewest significant digits that
+ * read back as exactly the same value. Returns the length of the result. */
+static int Ryaml_format_real_shortest(double x, char *str)
 {
-  SEXP s_retval = NULL;
-  int i = 0, j = 0, k = 0, n = 0, suffix_len = 0;
-  double x = 0, e = 0;
-  char str[REAL_BUF_SIZE], format[5] = "%.*f", *strp = NULL;
-
-  PROTECT(s_retval = allocVector(STRSXP, length(s_obj)));
-  for (i = 0; i < length(s_obj); i++) {
-    x = REAL(s_obj)[i];
-    if (x == R_PosInf) {
-      SET_STRING_ELT(s_retval, i, mkCharCE(".inf", CE_UTF8));
-    }
-    else if (x == R_NegInf) {
-      SET_STRING_ELT(s_retval, i, mkCharCE("-.inf", CE_UTF8));
+  char buf[32], digits[20], *p = NULL, *end = NULL;
+  int precision = 0, num_digits = 0, exponent = 0, i = 0, n = 0;
+
+  /* Any decimal with 15 or fewer significant digits maps to a distinct
+   * double, so if the 15 digit form doesn't read back correctly no shorter
+   * one will either. That isn't true of subnormals, which have fewer
+   * digits of precision. 17 digits are always enough. */
+  precision = (x != 0 && fabs(x) < DBL_MIN) ? 1 : 15;
+  for (; precision < 17; precision++) {
+    snprintf(buf, sizeof(buf), "%.*e", precision - 1, x);
+    if (strtod(buf, NULL) == x) {
+      break;
     }
-    else if (R_IsNA(x)) {
-      SET_STRING_ELT(s_retval, i, mkCharCE(".na.real", CE_UTF8));
+  }
+  if (precision == 17) {
+    snprintf(buf, sizeof(buf), "%.*e", precision - 1, x);
+  }
+
+  /* buf looks like [-]d.ddde[+-]dd */
+  p = buf;
+  if (*p == '-') {
+    str[n++] = '-';
+    p++;
+  }
+  for (; *p != 'e'; p++) {
+    if (*p != '.') {
+      digits[num_digits++] = *p;
     }
-    else if (R_IsNaN(x)) {
-      SET_STRING_ELT(s_retval, i, mkCharCE(".nan", CE_UTF8));
+  }
+  exponent = (int)strtol(p + 1, &end, 10);
+  while (num_digits > 1 && digits[num_digits - 1] == '0') {
+    num_digits--;
+  }
+
+  if (exponent >= -4 && exponent < 15) {
+    if (exponent < 0) {
+      str[n++] = '0';
+      str[n++] = '.';
+      for (i = exponent + 1; i < 0; i++) {
+        str[n++] = '0';
+      }
+      memcpy(str + n, digits, num_digits);
+      n += num_digits;
     }
     else {
-      if (x != 0) {
-        e = log10(fabs(x));
-        if (e < -4 || e >= precision) {
-          format[3] = 'e';
-        }
+      for (i = 0; i <= exponent; i++) {
+        str[n++] = i < num_digits ? digits[i] : '0';
       }
-      n = snprintf(str, REAL_BUF_SIZE, format, precision, x);
-      if (n >= REAL_BUF_SIZE) {
-        warning("string representation of numeric was truncated because it was more than %d characters", REAL_BUF_SIZE);
-      }
-      else if (n < 0) {
-        error("couldn't format numeric value");
+      str[n++] = '.';
+      if (num_digits > exponent + 1) {
+        memcpy(str + n, digits + exponent + 1, num_digits - exponent - 1);
+        n += num_digits - exponent - 1;
       }
       else {
-        /* tweak the string a little */
-        strp = str + n; /* end of the string */
-        j = n - 1;
-        if (format[3] == 'e') {
-          /* find 'e' first */
-          for (k = 0; j >= 0; j--, k++) {
-            if (str[j] == 'e') {
-              break;
-            }
-          }
-          if (k == 4 && str[j+2] == '0') {
-            /* windows sprintf likes to add an extra 0 to the exp part */
-            /* ex: 1.000e+007 */
-            str[j+2] = str[j+3];
-            str[j+3] = str[j+4];
-            str[j+4] = str[j+5]; /* null */
-            n -= 1;
-          }
-          strp = str + j;
-          j -= 1;
-        }
-        suffix_len = n - j;
+        str[n++] = '0';
+      }
+    }
+    str[n] = 0;
+  }
+  else {
+    str[n++] = digits[0];
+    str[n++] = '.';
+    if (num_digits > 1) {
+      memcpy(str + n, digits + 1, num_digits - 1);
+      n += num_digits - 1;
+    }
+    else {
+      str[n++] = '0';
+    }
+    n += snprintf(str + n, REAL_BUF_SIZE - n, "e%+03d", exponent);
+  }
+
+  return n;
+}
+
+/* Same test as R_IsNA, which worker threads can't call */
+static int Ryaml_is_na_real(double x)
+{
+  uint64_t bits = 0;
 
-        /* remove trailing zeros */
+  memcpy(&bits, &x, sizeof(bits));
+  return isnan(x) && (bits & 0xFFFFFFFF) == 1954;
+}
+
+/* Format a real for emitting into str, which must be able to hold
+ * REAL_BUF_SIZE characters. Returns the length of the result, or -1 if the
+ * value couldn't be formatted. This doesn't use the R API, so it is safe to
+ * call from worker threads. */
+static int Ryaml_format_real_value(double x, int precision, char *str)
+{
+  int j = 0, k = 0, n = 0, suffix_len = 0;
+  double e = 0;
+  char format[5] = "%.*f", *strp = NULL;
+
+  if (isinf(x)) {
+    strcpy(str, x > 0 ? ".inf" : "-.inf");
+  }
+  else if (isnan(x)) {
+    strcpy(str, Ryaml_is_na_real(x) ? ".na.real" : ".nan");
+  }
+  else if (precision == PRECISION_SHORTEST) {
+    return Ryaml_format_real_shortest(x, str);
+  }
+  else {
+    if (x != 0) {
+      e = log10(fabs(x));
+      if (e < -4 || e >= precision) {
+        format[3] = 'e';
+      }
+    }
+    n = snprintf(str, REAL_BUF_SIZE, format, precision, x);
+    if (n < 0 || n >= REAL_BUF_SIZE) {
+      return -1;
+    }
+    else {
+      /* tweak the string a little */
+      strp = str + n; /* end of the string */
+      j = n - 1;
+      if (format[3] == 'e') {
+        /* find 'e' first */
         for (k = 0; j >= 0; j--, k++) {
-          if (str[j] != '0' || str[j-1] == '.') {
+          if (str[j] == 'e') {
             break;
           }
         }
-        if (k > 0) {
-          memmove(str + j + 1, strp, suffix_len);
+        if (k == 4 && str[j+2] == '0') {
+          /* windows sprintf likes to add an extra 0 to the exp part */
+          /* ex: 1.000e+007 */
+          str[j+2] = str[j+3];
+          str[j+3] = str[j+4];
+          str[j+4] = str[j+5]; /* null */
+          n -= 1;
         }
+        strp = str + j;
+        j -= 1;
       }
+      suffix_len = n - j;
 
-      SET_STRING_ELT(s_retval, i, mkCharCE(str, CE_UTF8));
+      /* remove trailing zeros */
+      for (k = 0; j >= 0; j--, k++) {
+        if (str[j] != '0' || str[j-1] == '.') {
+          break;
+        }
+      }
+      if (k > 0) {
+        memmove(str + j + 1, strp, suffix_len);
+      }
     }
   }
-  UNPROTECT(1);
-  return s_retval;
+
+  return strlen(str);
 }
 
-/* Format a vector of ints for emitting. Handle NAs. */
-static SEXP Ryaml_format_int(SEXP s_obj)
+/* Format an int for emitting into str, which must be able to hold
+ * INT_BUF_SIZE characters. Returns the length of the result. */
+static int Ryaml_format_int_value(int x, char *str)
 {
-  SEXP s_retval = NULL;
-  int i = 0;
+  char digits[INT_BUF_SIZE];
+  unsigned int u = 0;
+  int i = 0, n = 0;
 
-  PROTECT(s_retval = coerceVector(s_obj, STRSXP));
-  for (i = 0; i < length(s_obj); i++) {
-    if (INTEGER(s_obj)[i] == NA_INTEGER) {
-      SET_STRING_ELT(s_retval, i, mkCharCE(".na.integer", CE_UTF8));
-    }
+  if (x == NA_INTEGER) {
+    strcpy(str, ".na.integer");
+    return 11;
   }
-  UNPROTECT(1);
 
-  return s_retval;
-}
+  if (x < 0) {
+    str[n++] = '-';
+    u = 0u - (unsigned int)x;
+  }
+  else {
+    u = (unsigned int)x;
+  }
 
-/* Format a vector of logicals for emitting. Handle NAs. */
-static SEXP Ryaml_format_logical(SEXP s_obj)
-{
-  SEXP s_retval = NULL;
-  int i = 0, val = 0;
+  do {
+    digits[i++] = '0' + (u % 10);
+    u /= 10;
+  } while (u > 0);
 
-  PROTECT(s_retval = allocVector(STRSXP, length(s_obj)));
-  for (i = 0; i < length(s_obj); i++) {
-    val = LOGICAL(s_obj)[i];
-    if (val == NA_LOGICAL) {
-      SET_STRING_ELT(s_retval, i, mkCharCE(".na", CE_UTF8));
-    }
-    else if (val == 0) {
-      SET_STRING_ELT(s_retval, i, mkCharCE("no", CE_UTF8));
-    }
-    else {
-      SET_STRING_ELT(s_retval, i, mkCharCE("yes", CE_UTF8));
-    }
+  while (i > 0) {
+    str[n++] = digits[--i];
   }
-  UNPROTECT(1);
+  str[n] = 0;
 
-  return s_retval;
+  return n;
+}
+
+/* Format a logical for emitting */
+static const char *Ryaml_format_logical_value(int x)
+{
+  if (x == NA_LOGICAL) {
+    return ".na";
+  }
+  return x == 0 ? "no" : "yes";
 }
 
 /* Format a vector of strings for emitting. Handle NAs. */
@@ -258,6 +490,199 @@ static yaml_scalar_style_t Ryaml_string_style(SEXP s_obj)
   return YAML_ANY_SCALAR_STYLE;
 }
 
+static size_t Ryaml_pointer_hash(SEXP s_obj, size_t size)
+{
+  size_t hash = (size_t)((uintptr_t)s_obj >> 4);
+
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3b;
+  hash ^= hash >> 16;
+  return hash & (size - 1);
+}
+
+/* Make room in the style cache. Once the cache reaches its maximum size, it
+ * is emptied instead, so that emitting many distinct strings doesn't use an
+ * unbounded amount of memory. */
+static void Ryaml_grow_style_cache(s_emitter_context *ctx)
+{
+  s_style_entry *old_styles = ctx->styles;
+  size_t old_size = ctx->styles_size, size = 0, i = 0, j = 0;
+
+  if (old_size >= STYLE_CACHE_MAX_SIZE) {
+    memset(ctx->styles, 0, sizeof(s_style_entry) * old_size);
+    REPROTECT(ctx->s_style_keys = allocVector(VECSXP, old_size), ctx->style_keys_index);
+    ctx->styles_count = 0;
+    return;
+  }
+
+  size = old_size == 0 ? STYLE_CACHE_INITIAL_SIZE : old_size * 2;
+  ctx->styles = (s_style_entry *)R_alloc(size, sizeof(s_style_entry));
+  memset(ctx->styles, 0, sizeof(s_style_entry) * size);
+  ctx->styles_size = size;
+  ctx->styles_count = 0;
+
+  /* The old CHARSXPs are unprotected from here on, but nothing below
+   * allocates. */
+  REPROTECT(ctx->s_style_keys = allocVector(VECSXP, size), ctx->style_keys_index);
+  for (i = 0; i < old_size; i++) {
+    if (old_styles[i].s_chr == NULL) {
+      continue;
+    }
+
+    j = Ryaml_pointer_hash(old_styles[i].s_chr, size);
+    while (ctx->styles[j].s_chr != NULL) {
+      j = (j + 1) & (size - 1);
+    }
+    ctx->styles[j] = old_styles[i];
+    SET_VECTOR_ELT(ctx->s_style_keys, j, old_styles[i].s_chr);
+    ctx->styles_count++;
+  }
+}
+
+/* Take a CHARSXP, return its scalar style and analysis from the cache,
+ * computing them if this string hasn't been seen before */
+static s_style_entry *Ryaml_cached_style(s_emitter_context *ctx, SEXP s_chr)
+{
+  s_style_entry *entry = NULL;
+  size_t i = 0;
+
+  if (ctx->styles_count * 2 >= ctx->styles_size) {
+    Ryaml_grow_style_cache(ctx);
+  }
+
+  i = Ryaml_pointer_hash(s_chr, ctx->styles_size);
+  while (ctx->styles[i].s_chr != NULL) {
+    if (ctx->styles[i].s_chr == s_chr) {
+      return &ctx->styles[i];
+    }
+    i = (i + 1) & (ctx->styles_size - 1);
+  }
+
+  entry = &ctx->styles[i];
+  entry->s_chr = s_chr;
+  SET_VECTOR_ELT(ctx->s_style_keys, i, s_chr);
+  ctx->styles_count++;
+
+  entry->style = Ryaml_string_style(s_chr);
+  yaml_emitter_analyze_scalar_value(ctx->emitter, (yaml_char_t *)CHAR(s_chr),
+      LENGTH(s_chr), &entry->analysis);
+
+  return entry;
+}
+
+/* Return 1 if an object is worth emitting with an anchor when it occurs more
+ * than once */
+static int Ryaml_is_anchorable(SEXP s_obj)
+{
+  switch (TYPEOF(s_obj)) {
+    case VECSXP:
+      return length(s_obj) > 0;
+
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case STRSXP:
+      return length(s_obj) > 1;
+
+    default:
+      return 0;
+  }
+}
+
+/* Find the anchor table entry for an object. If the object isn't in the
+ * table and insert is set, add it with a count of zero, otherwise return
+ * NULL. */
+static s_anchor_entry *Ryaml_find_anchor(
+  s_emitter_context *ctx,
+  SEXP s_obj,
+  int insert)
+{
+  s_anchor_entry *old_anchors = NULL;
+  size_t old_size = 0, i = 0, j = 0;
+
+  if (insert && ctx->anchors_count * 2 >= ctx->anchors_size) {
+    old_anchors = ctx->anchors;
+    old_size = ctx->anchors_size;
+
+    ctx->anchors_size = old_size == 0 ? ANCHOR_TABLE_INITIAL_SIZE : old_size * 2;
+    ctx->anchors = (s_anchor_entry *)R_alloc(ctx->anchors_size, sizeof(s_anchor_entry));
+    memset(ctx->anchors, 0, sizeof(s_anchor_entry) * ctx->anchors_size);
+    for (i = 0; i < old_size; i++) {
+      if (old_anchors[i].s_obj == NULL) {
+        continue;
+      }
+      j = Ryaml_pointer_hash(old_anchors[i].s_obj, ctx->anchors_size);
+      while (ctx->anchors[j].s_obj != NULL) {
+        j = (j + 1) & (ctx->anchors_size - 1);
+      }
+      ctx->anchors[j] = old_anchors[i];
+    }
+  }
+
+  if (ctx->anchors_size == 0) {
+    return NULL;
+  }
+
+  i = Ryaml_pointer_hash(s_obj, ctx->anchors_size);
+  while (ctx->anchors[i].s_obj != NULL) {
+    if (ctx->anchors[i].s_obj == s_obj) {
+      return &ctx->anchors[i];
+    }
+    i = (i + 1) & (ctx->anchors_size - 1);
+  }
+
+  if (!insert) {
+    return NULL;
+  }
+  ctx->anchors[i].s_obj = s_obj;
+  ctx->anchors_count++;
+  return &ctx->anchors[i];
+}
+
+/* Count how many times each list and vector occurs in an object. A list that
+ * was already seen isn't walked again, since it will be emitted as an alias
+ * the second time. */
+static void Ryaml_count_anchors(
+  s_emitter_context *ctx,
+  SEXP s_obj)
+{
+  SEXP *stack = NULL, *new_stack = NULL, s_elt = NULL;
+  s_anchor_entry *entry = NULL;
+  int depth = 0, size = 0, i = 0;
+
+  size = EMIT_STACK_INITIAL_SIZE;
+  stack = (SEXP *)R_alloc(size, sizeof(SEXP));
+  stack[depth++] = s_obj;
+
+  while (depth > 0) {
+    s_obj = stack[--depth];
+    if (!Ryaml_is_anchorable(s_obj)) {
+      continue;
+    }
+
+    entry = Ryaml_find_anchor(ctx, s_obj, 1);
+    entry->count++;
+    if (entry->count > 1 || TYPEOF(s_obj) != VECSXP) {
+      continue;
+    }
+
+    for (i = length(s_obj) - 1; i >= 0; i--) {
+      s_elt = VECTOR_ELT(s_obj, i);
+      if (!Ryaml_is_anchorable(s_elt)) {
+        continue;
+      }
+
+      if (depth == size) {
+        new_stack = (SEXP *)R_alloc(size * 2, sizeof(SEXP));
+        memcpy(new_stack, stack, sizeof(SEXP) * size);
+        stack = new_stack;
+        size *= 2;
+      }
+      stack[depth++] = s_elt;
+    }
+  }
+}
+
 /* Take a vector and an index and return another vector of size 1 */
 static SEXP Ryaml_yoink(SEXP s_vec, int index)
 {
@@ -305,12 +730,37 @@ static SEXP Ryaml_yoink(SEXP s_vec, int index)
   return s_tmp;
 }
 
+/* Write a chunk of emitter output by calling cat() on the connection. The
+ * emitter only flushes at character boundaries, so each chunk is valid
+ * UTF-8 on its own. */
+static int Ryaml_serialize_to_connection_write_handler(
+    s_emitter_output *output,
+    unsigned char *buffer,
+    size_t size)
+{
+  SEXP s_chunk = NULL;
+  int error_occurred = 0;
+
+  PROTECT(s_chunk = allocVector(STRSXP, 1));
+  SET_STRING_ELT(s_chunk, 0, mkCharLenCE((const char *)buffer, size, CE_UTF8));
+  SETCADR(output->s_call, s_chunk);
+  R_tryEval(output->s_call, R_GlobalEnv, &error_occurred);
+  SETCADR(output->s_call, R_NilValue);
+  UNPROTECT(1); /* s_chunk */
+
+  return !error_occurred;
+}
+
 static int Ryaml_serialize_to_yaml_write_handler(
     void *data, 
     unsigned char *buffer,
     size_t size)
 {
   s_emitter_output *output = (s_emitter_output *)data;
+  if (output->s_call != NULL) {
+    return Ryaml_serialize_to_connection_write_handler(output, buffer, size);
+  }
+
   if (output->size + size > output->capa) {
     output->capa = (output->capa + size) * 2;
     output->buffer = (char *)realloc(output->buffer, output->capa * sizeof(char));
@@ -325,24 +775,85 @@ static int Ryaml_serialize_to_yaml_write_handler(
   return 1;
 }
 
+/* Pass the current event to the emitter, or record it if the context has an
+ * event log */
+static int Ryaml_emit_event(
+  s_emitter_context *ctx,
+  int empty,
+  const yaml_scalar_analysis_t *analysis)
+{
+  s_event_log *log = ctx->log;
+  s_recorded_event *events = NULL, *recorded = NULL;
+
+  if (log == NULL) {
+    return yaml_emitter_emit_hinted(ctx->emitter, ctx->event, empty, analysis);
+  }
+
+  if (log->count == log->capa) {
+    events = (s_recorded_event *)realloc(log->events,
+        sizeof(s_recorded_event) * (log->capa == 0 ? 1024 : log->capa * 2));
+    if (events == NULL) {
+      yaml_event_delete(ctx->event);
+      Ryaml_set_error_msg(ctx->error_ctx, "couldn't allocate memory for emitter events");
+      return 0;
+    }
+    log->events = events;
+    log->capa = log->capa == 0 ? 1024 : log->capa * 2;
+  }
+
+  recorded = &log->events[log->count++];
+  recorded->event = *ctx->event;
+  recorded->empty = empty;
+  recorded->has_analysis = analysis != NULL;
+  if (analysis != NULL) {
+    recorded->analysis = *analysis;
+  }
+  memset(ctx->event, 0, sizeof(yaml_event_t));
+
+  return 1;
+}
+
+/* Events that were passed to an emitter have already been cleared, so this
+ * only frees the ones that weren't */
+static void Ryaml_free_event_log(s_event_log *log)
+{
+  size_t i = 0;
+
+  for (i = 0; i < log->count; i++) {
+    yaml_event_delete(&log->events[i].event);
+  }
+  free(log->events);
+  log->events = NULL;
+  log->count = log->capa = 0;
+}
+
 static int emit_char(
-  yaml_emitter_t *emitter,
-  yaml_event_t *event,
+  s_emitter_context *ctx,
   SEXP s_obj,
   const char *tag,
   int implicit_tag,
-  yaml_scalar_style_t scalar_style)
+  yaml_scalar_style_t scalar_style,
+  const yaml_scalar_analysis_t *analysis)
 {
-  yaml_scalar_event_initialize(event, NULL, (yaml_char_t *)tag,
+  yaml_scalar_event_initialize(ctx->event, NULL, (yaml_char_t *)tag,
       (yaml_char_t *)CHAR(s_obj), LENGTH(s_obj),
       implicit_tag, implicit_tag, scalar_style);
 
-  return yaml_emitter_emit(emitter, event);
+  return Ryaml_emit_event(ctx, 0, analysis);
+}
+
+/* Emit a string that is a map key */
+static int emit_key(
+  s_emitter_context *ctx,
+  SEXP s_chr)
+{
+  s_style_entry *entry = Ryaml_cached_style(ctx, s_chr);
+
+  return emit_char(ctx, s_chr, NULL, 1, entry->style, &entry->analysis);
 }
 
 static int emit_string(
-  yaml_emitter_t *emitter,
-  yaml_event_t *event,
+  s_emitter_context *ctx,
   SEXP s_obj,
   const char *tag,
   int implicit_tag)
@@ -350,6 +861,7 @@ static int emit_string(
   SEXP s_new_obj = NULL, s_chr = NULL, quoted = NULL;
   int result = 0, i = 0, verbatim = 0, quote_it = 0;
   yaml_scalar_style_t scalar_style = YAML_PLAIN_SCALAR_STYLE;
+  s_style_entry *entry = NULL;
 
   verbatim = Ryaml_has_class(s_obj, "verbatim");
   if (!verbatim) {
@@ -369,10 +881,12 @@ static int emit_string(
   result = 0;
   for (i = 0; i < length(s_obj); i++) {
     PROTECT(s_chr = STRING_ELT(s_obj, i));
+    entry = Ryaml_cached_style(ctx, s_chr);
     if (!verbatim && !quote_it) {
-      scalar_style = Ryaml_string_style(s_chr);
+      scalar_style = entry->style;
     }
-    result = emit_char(emitter, event, s_chr, tag, implicit_tag, scalar_style);
+    result = emit_char(ctx, s_chr, tag, implicit_tag, scalar_style,
+        &entry->analysis);
     UNPROTECT(1); /* s_chr */
 
     if (!result) {
@@ -385,118 +899,577 @@ static int emit_string(
 }
 
 static int emit_factor(
-  yaml_emitter_t *emitter,
-  yaml_event_t *event,
+  s_emitter_context *ctx,
   SEXP s_obj,
   const char *tag,
   int implicit_tag)
 {
-  SEXP s_levels = NULL, s_level_chr = NULL;
-  yaml_scalar_style_t *scalar_styles = NULL, scalar_style;
-  int i = 0, len = 0, level_idx = 0, result = 0, *scalar_style_is_set = NULL;
+  SEXP s_levels = NULL, s_level_chr = NULL, s_na_chr = NULL;
+  s_style_entry *entry = NULL;
+  int i = 0, len = 0, level_idx = 0, result = 0;
 
   s_levels = GET_LEVELS(s_obj);
   len = length(s_levels);
-  scalar_styles = (yaml_scalar_style_t *)malloc(sizeof(yaml_scalar_style_t) * len);
-  scalar_style_is_set = (int *)calloc(len, sizeof(int));
+  PROTECT(s_na_chr = mkCharCE(".na.character", CE_UTF8));
 
   result = 1;
   for (i = 0; i < length(s_obj); i++) {
     level_idx = INTEGER(s_obj)[i];
     if (level_idx == NA_INTEGER || level_idx < 1 || level_idx > len) {
-      s_level_chr = mkCharCE(".na.character", CE_UTF8);
-      scalar_style = YAML_ANY_SCALAR_STYLE;
+      s_level_chr = s_na_chr;
     }
     else {
       s_level_chr = STRING_ELT(s_levels, level_idx - 1);
-      if (!scalar_style_is_set[level_idx - 1]) {
-        scalar_styles[level_idx - 1] = Ryaml_string_style(s_level_chr);
-      }
-      scalar_style = scalar_styles[level_idx - 1];
     }
 
-    result = emit_char(emitter, event, s_level_chr, tag, implicit_tag, scalar_style);
+    entry = Ryaml_cached_style(ctx, s_level_chr);
+    result = emit_char(ctx, s_level_chr, tag, implicit_tag, entry->style,
+        &entry->analysis);
     if (!result) {
       break;
     }
   }
+  UNPROTECT(1); /* s_na_chr */
 
-  free(scalar_styles);
-  free(scalar_style_is_set);
   return result;
 }
 
-static int emit_nil(
-  yaml_emitter_t *emitter,
-  yaml_event_t *event,
-  SEXP s_obj)
+static void Ryaml_free_slab(s_format_slab *slab)
 {
-  yaml_scalar_event_initialize(event, NULL, NULL, (yaml_char_t *)"~", 1, 1, 1,
-      YAML_ANY_SCALAR_STYLE);
-
-  return yaml_emitter_emit(emitter, event);
+  free(slab->buffer);
+  free(slab->offsets);
+  slab->buffer = NULL;
+  slab->offsets = NULL;
+  slab->capa = 0;
+  slab->count = 0;
 }
 
-static int emit_object(
-  yaml_emitter_t *emitter,
-  yaml_event_t *event,
-  SEXP s_obj,
-  int omap,
-  int column_major,
-  int precision,
-  SEXP s_handlers)
+/* Format elements start..end-1 of a real, integer or logical vector into a
+ * slab. data is the vector's REAL(), INTEGER() or LOGICAL() pointer, which
+ * has to be taken on the main thread. This doesn't use the R API, so it is
+ * safe to call from worker threads. Returns 0 if a value couldn't be
+ * formatted or memory ran out. */
+static int Ryaml_format_slab(
+  s_format_slab *slab,
+  int type,
+  const void *data,
+  int start,
+  int end,
+  int precision)
 {
-  SEXP s_chr = NULL, s_names = NULL, s_elt = NULL, s_type = NULL,
-       s_classes = NULL, s_class = NULL, s_tmp = NULL, s_inspect = NULL,
-       s_handler = NULL, s_new_obj = NULL, s_tag = NULL;
-  const char *inspect = NULL, *klass = NULL, *tag = NULL;
-  int implicit_tag = 0, tag_applied = 0, rows = 0, cols = 0, i = 0, j = 0,
-      result = 0, err = 0, len = 0, handled = 0;
+  char str[REAL_BUF_SIZE], *new_buffer = NULL;
+  const char *value = NULL;
+  size_t used = 0, *new_offsets = NULL;
+  int i = 0, n = 0;
+
+  if (slab->count < end - start) {
+    new_offsets = (size_t *)realloc(slab->offsets, sizeof(size_t) * (end - start + 1));
+    if (new_offsets == NULL) {
+      return 0;
+    }
+    slab->offsets = new_offsets;
+    slab->count = end - start;
+  }
 
-#if DEBUG
-  Rprintf("=== Emitting ===\n");
-  PrintValue(s_obj);
-#endif
+  for (i = start; i < end; i++) {
+    switch (type) {
+      case REALSXP:
+        n = Ryaml_format_real_value(((const double *)data)[i], precision, str);
+        value = str;
+        break;
 
-  /* Look for custom handler by class */
-  PROTECT(s_classes = Ryaml_get_classes(s_obj));
-  for (i = 0; i < length(s_classes); i++) {
-    PROTECT(s_class = STRING_ELT(s_classes, i));
-    klass = CHAR(s_class);
-    PROTECT(s_handler = Ryaml_find_handler(s_handlers, klass));
-    if (s_handler != R_NilValue) {
-      err = Ryaml_run_handler(s_handler, s_obj, &s_new_obj);
+      case INTSXP:
+        n = Ryaml_format_int_value(((const int *)data)[i], str);
+        value = str;
+        break;
 
-      if (err != 0) {
-        warning("an error occurred when handling object of class '%s'; using default handler", klass);
-      }
-      else {
-        handled = 1;
+      default:
+        value = Ryaml_format_logical_value(((const int *)data)[i]);
+        n = strlen(value);
+        break;
+    }
+    if (n < 0) {
+      return 0;
+    }
 
-#if DEBUG
-        PROTECT(s_new_obj);
-        Rprintf("Result from custom handler:\n");
-        PrintValue(s_new_obj);
-        UNPROTECT(1);
-#endif
+    if (used + n > slab->capa) {
+      new_buffer = (char *)realloc(slab->buffer, (slab->capa + n) * 2);
+      if (new_buffer == NULL) {
+        return 0;
       }
+      slab->buffer = new_buffer;
+      slab->capa = (slab->capa + n) * 2;
     }
-    UNPROTECT(2); /* s_handler, s_class */
+    memcpy(slab->buffer + used, value, n);
 
-    if (handled) {
-      break;
-    }
+    slab->offsets[i - start] = used;
+    used += n;
   }
-  UNPROTECT(1); /* s_classes */
+  slab->offsets[end - start] = used;
 
-  if (handled) {
-    s_obj = s_new_obj;
+  return 1;
+}
+
+/* Emit the formatted values in a slab */
+static int emit_slab(
+  s_emitter_context *ctx,
+  s_format_slab *slab,
+  int count,
+  const char *tag,
+  int implicit_tag)
+{
+  int i = 0, result = 1;
+
+  for (i = 0; result && i < count; i++) {
+    yaml_scalar_event_initialize(ctx->event, NULL, (yaml_char_t *)tag,
+        (yaml_char_t *)slab->buffer + slab->offsets[i],
+        slab->offsets[i + 1] - slab->offsets[i],
+        implicit_tag, implicit_tag, YAML_ANY_SCALAR_STYLE);
+    result = Ryaml_emit_event(ctx, 0, NULL);
   }
 
-  /* Deparse function objects first, since this operation creates a new object.
-   * Doing this here prevents having to reprotect an object later. */
-  if ((TYPEOF(s_obj) == CLOSXP || TYPEOF(s_obj) == SPECIALSXP ||
-      TYPEOF(s_obj) == BUILTINSXP)) {
+  return result;
+}
+
+/* Emit a long vector by formatting chunks of it on several threads at once.
+ * The main thread emits each round of chunks in order once they are all
+ * formatted. */
+static int emit_formatted_parallel(
+  s_emitter_context *ctx,
+  SEXP s_obj,
+  const char *tag,
+  int implicit_tag)
+{
+  s_format_slab *slabs = NULL;
+  const void *data = NULL;
+  int type = 0, len = 0, threads = 0, start = 0, failed = 0, result = 1, i = 0;
+
+  type = TYPEOF(s_obj);
+  len = length(s_obj);
+  threads = ctx->threads;
+  data = type == REALSXP ? (const void *)REAL(s_obj) :
+    type == INTSXP ? (const void *)INTEGER(s_obj) : (const void *)LOGICAL(s_obj);
+
+  slabs = (s_format_slab *)R_alloc(threads, sizeof(s_format_slab));
+  memset(slabs, 0, sizeof(s_format_slab) * threads);
+
+  for (start = 0; result && start < len; start += threads * FORMAT_CHUNK_SIZE) {
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1) reduction(|:failed)
+#endif
+    for (i = 0; i < threads; i++) {
+      int chunk_start = start + i * FORMAT_CHUNK_SIZE;
+      int chunk_end = chunk_start + FORMAT_CHUNK_SIZE < len ? chunk_start + FORMAT_CHUNK_SIZE : len;
+
+      if (chunk_start < chunk_end &&
+          !Ryaml_format_slab(&slabs[i], type, data, chunk_start, chunk_end, ctx->precision)) {
+        failed = 1;
+      }
+    }
+    if (failed) {
+      Ryaml_set_error_msg(ctx->error_ctx, "couldn't format numeric value");
+      result = 0;
+      break;
+    }
+
+    for (i = 0; result && i < threads && start + i * FORMAT_CHUNK_SIZE < len; i++) {
+      result = emit_slab(ctx, &slabs[i],
+          (start + (i + 1) * FORMAT_CHUNK_SIZE < len ? FORMAT_CHUNK_SIZE :
+           len - start - i * FORMAT_CHUNK_SIZE), tag, implicit_tag);
+    }
+  }
+
+  for (i = 0; i < threads; i++) {
+    Ryaml_free_slab(&slabs[i]);
+  }
+
+  return result;
+}
+
+/* Emit a real, integer or logical vector, formatting each element into a
+ * scratch buffer */
+static int emit_formatted(
+  s_emitter_context *ctx,
+  SEXP s_obj,
+  const char *tag,
+  int implicit_tag)
+{
+  char str[REAL_BUF_SIZE];
+  const char *value = NULL;
+  int i = 0, n = 0, result = 0;
+
+  if (ctx->threads > 1 && length(s_obj) > FORMAT_CHUNK_SIZE) {
+    return emit_formatted_parallel(ctx, s_obj, tag, implicit_tag);
+  }
+
+  result = 1;
+  for (i = 0; i < length(s_obj); i++) {
+    switch (TYPEOF(s_obj)) {
+      case REALSXP:
+        n = Ryaml_format_real_value(REAL(s_obj)[i], ctx->precision, str);
+        value = str;
+        break;
+
+      case INTSXP:
+        n = Ryaml_format_int_value(INTEGER(s_obj)[i], str);
+        value = str;
+        break;
+
+      default:
+        value = Ryaml_format_logical_value(LOGICAL(s_obj)[i]);
+        n = strlen(value);
+        break;
+    }
+    if (n < 0) {
+      Ryaml_set_error_msg(ctx->error_ctx, "couldn't format numeric value");
+      return 0;
+    }
+
+    yaml_scalar_event_initialize(ctx->event, NULL, (yaml_char_t *)tag,
+        (yaml_char_t *)value, n, implicit_tag, implicit_tag,
+        YAML_ANY_SCALAR_STYLE);
+    result = Ryaml_emit_event(ctx, 0, NULL);
+    if (!result) {
+      break;
+    }
+  }
+
+  return result;
+}
+
+/* Emit a raw vector as a base64 encoded binary scalar */
+static int emit_binary(
+  s_emitter_context *ctx,
+  SEXP s_obj,
+  const char *tag)
+{
+  char *value = NULL;
+  size_t len = 0;
+
+  value = (char *)malloc(Ryaml_base64_encoded_size(LENGTH(s_obj)) + 1);
+  if (value == NULL) {
+    Ryaml_set_error_msg(ctx->error_ctx, "couldn't allocate memory to encode raw vector");
+    return 0;
+  }
+  len = Ryaml_base64_encode(RAW(s_obj), LENGTH(s_obj), value);
+
+  yaml_scalar_event_initialize(ctx->event, NULL,
+      (yaml_char_t *)(tag == NULL ? "tag:yaml.org,2002:binary" : tag),
+      (yaml_char_t *)value, len, 0, 0, YAML_LITERAL_SCALAR_STYLE);
+  free(value);
+
+  return Ryaml_emit_event(ctx, 0, NULL);
+}
+
+static int emit_nil(
+  s_emitter_context *ctx,
+  SEXP s_obj)
+{
+  yaml_scalar_event_initialize(ctx->event, NULL, NULL, (yaml_char_t *)"~", 1, 1, 1,
+      YAML_ANY_SCALAR_STYLE);
+
+  return Ryaml_emit_event(ctx, 0, NULL);
+}
+
+static int emit_object(s_emitter_context *ctx, SEXP s_obj);
+
+/* Decide how a data.frame column can be emitted. A cell of a column is a
+ * length-one vector without attributes, so only its base class is looked up
+ * in the handlers. */
+static e_column_kind Ryaml_column_kind(s_emitter_context *ctx, SEXP s_column)
+{
+  e_column_kind kind = COLUMN_OTHER;
+  const char *klass = NULL;
+
+  switch (TYPEOF(s_column)) {
+    case REALSXP:
+      kind = COLUMN_REAL;
+      klass = "numeric";
+      break;
+
+    case INTSXP:
+      if (Ryaml_has_class(s_column, "factor")) {
+        kind = COLUMN_FACTOR;
+        klass = "character";
+      }
+      else {
+        kind = COLUMN_INT;
+        klass = "integer";
+      }
+      break;
+
+    case LGLSXP:
+      kind = COLUMN_LOGICAL;
+      klass = "logical";
+      break;
+
+    case STRSXP:
+      kind = COLUMN_STRING;
+      klass = "character";
+      break;
+
+    default:
+      return COLUMN_OTHER;
+  }
+
+  if (Ryaml_find_handler(ctx->s_handlers, klass) != R_NilValue) {
+    return COLUMN_OTHER;
+  }
+  return kind;
+}
+
+/* Emit one cell of a data.frame column */
+static int emit_column_cell(
+  s_emitter_context *ctx,
+  s_row_column *column,
+  int row,
+  int block_row,
+  SEXP s_na_chr)
+{
+  SEXP s_chr = NULL, s_levels = NULL, s_tmp = NULL;
+  s_style_entry *entry = NULL;
+  size_t offset = 0;
+  int level_idx = 0, result = 0;
+
+  switch (column->kind) {
+    case COLUMN_REAL:
+    case COLUMN_INT:
+    case COLUMN_LOGICAL:
+      offset = column->slab.offsets[block_row];
+      yaml_scalar_event_initialize(ctx->event, NULL, NULL,
+          (yaml_char_t *)column->slab.buffer + offset,
+          column->slab.offsets[block_row + 1] - offset,
+          1, 1, YAML_ANY_SCALAR_STYLE);
+      result = Ryaml_emit_event(ctx, 0, NULL);
+      break;
+
+    case COLUMN_STRING:
+    case COLUMN_FACTOR:
+      if (column->kind == COLUMN_STRING) {
+        s_chr = STRING_ELT(column->s_column, row);
+      }
+      else {
+        s_levels = GET_LEVELS(column->s_column);
+        level_idx = INTEGER(column->s_column)[row];
+        if (level_idx == NA_INTEGER || level_idx < 1 || level_idx > LENGTH(s_levels)) {
+          s_chr = NA_STRING;
+        }
+        else {
+          s_chr = STRING_ELT(s_levels, level_idx - 1);
+        }
+      }
+      if (s_chr == NA_STRING) {
+        s_chr = s_na_chr;
+      }
+
+      entry = Ryaml_cached_style(ctx, s_chr);
+      result = emit_char(ctx, s_chr, NULL, 1, entry->style, &entry->analysis);
+      break;
+
+    default:
+      /* Need to create a vector of size one, then emit it */
+      PROTECT(s_tmp = Ryaml_yoink(column->s_column, row));
+      result = emit_object(ctx, s_tmp);
+      UNPROTECT(1);
+      break;
+  }
+
+  return result;
+}
+
+/* Emit a data.frame as a sequence of mappings, one per row. Numeric and
+ * logical columns are formatted a block of rows at a time, and strings are
+ * emitted straight from the column, so no R objects are allocated per cell
+ * unless a column needs the general emit_object treatment. */
+static int emit_data_frame_rows(
+  s_emitter_context *ctx,
+  SEXP s_obj,
+  const char *anchor,
+  const char *tag,
+  int implicit_tag)
+{
+  yaml_event_t *event = ctx->event;
+  SEXP s_names = NULL, s_na_chr = NULL;
+  s_row_column *columns = NULL, *column = NULL;
+  s_style_entry *entry = NULL;
+  int rows = 0, cols = 0, start = 0, end = 0, i = 0, j = 0, result = 0,
+      failed = 0;
+
+  rows = length(VECTOR_ELT(s_obj, 0));
+  cols = length(s_obj);
+  PROTECT(s_names = GET_NAMES(s_obj));
+  PROTECT(s_na_chr = mkCharCE(".na.character", CE_UTF8));
+
+  columns = (s_row_column *)R_alloc(cols, sizeof(s_row_column));
+  for (j = 0; j < cols; j++) {
+    column = &columns[j];
+    column->s_column = VECTOR_ELT(s_obj, j);
+    column->kind = Ryaml_column_kind(ctx, column->s_column);
+    column->s_key = STRING_ELT(s_names, j);
+
+    entry = Ryaml_cached_style(ctx, column->s_key);
+    column->key_style = entry->style;
+    column->key_analysis = entry->analysis;
+
+    memset(&column->slab, 0, sizeof(s_format_slab));
+    column->type = TYPEOF(column->s_column);
+    switch (column->kind) {
+      case COLUMN_REAL:
+        column->data = REAL(column->s_column);
+        break;
+
+      case COLUMN_INT:
+        column->data = INTEGER(column->s_column);
+        break;
+
+      case COLUMN_LOGICAL:
+        column->data = LOGICAL(column->s_column);
+        break;
+
+      default:
+        column->data = NULL;
+        break;
+    }
+  }
+
+  yaml_sequence_start_event_initialize(event, (yaml_char_t *)anchor,
+      (yaml_char_t *)tag, implicit_tag, YAML_ANY_SEQUENCE_STYLE);
+  result = Ryaml_emit_event(ctx, rows == 0, NULL);
+
+  for (start = 0; result && start < rows; start = end) {
+    end = start + ROW_BLOCK_SIZE < rows ? start + ROW_BLOCK_SIZE : rows;
+
+    /* Columns are formatted in parallel when threads are enabled */
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(ctx->threads) if (ctx->threads > 1) schedule(dynamic) reduction(|:failed)
+#endif
+    for (j = 0; j < cols; j++) {
+      if (columns[j].data != NULL &&
+          !Ryaml_format_slab(&columns[j].slab, columns[j].type, columns[j].data, start, end, ctx->precision)) {
+        failed = 1;
+      }
+    }
+    if (failed) {
+      Ryaml_set_error_msg(ctx->error_ctx, "couldn't format numeric value");
+      result = 0;
+      break;
+    }
+
+    for (i = start; i < end; i++) {
+      yaml_mapping_start_event_initialize(event, NULL, NULL, 1,
+          YAML_ANY_MAPPING_STYLE);
+      result = Ryaml_emit_event(ctx, 0, NULL);
+
+      for (j = 0; result && j < cols; j++) {
+        column = &columns[j];
+        result = emit_char(ctx, column->s_key, NULL, 1, column->key_style,
+            &column->key_analysis);
+
+        if (result) {
+          result = emit_column_cell(ctx, column, i, i - start, s_na_chr);
+        }
+      }
+
+      if (result) {
+        yaml_mapping_end_event_initialize(event);
+        result = Ryaml_emit_event(ctx, 0, NULL);
+      }
+
+      if (!result) {
+        break;
+      }
+    }
+  }
+
+  if (result) {
+    yaml_sequence_end_event_initialize(event);
+    result = Ryaml_emit_event(ctx, 0, NULL);
+  }
+
+  for (j = 0; j < cols; j++) {
+    Ryaml_free_slab(&columns[j].slab);
+  }
+
+  UNPROTECT(2); /* s_names, s_na_chr */
+  return result;
+}
+
+/* Emit an object, except that for a list only the start event is emitted and
+ * the list is described in frame, so that the caller can emit its elements.
+ * Otherwise frame->kind is set to FRAME_NONE. */
+static int emit_node(
+  s_emitter_context *ctx,
+  SEXP s_obj,
+  s_emit_frame *frame)
+{
+  yaml_event_t *event = ctx->event;
+  SEXP s_type = NULL, s_classes = NULL, s_class = NULL, s_inspect = NULL,
+       s_handler = NULL, s_new_obj = NULL, s_tag = NULL;
+  s_anchor_entry *anchor_entry = NULL;
+  const char *inspect = NULL, *klass = NULL, *tag = NULL, *anchor = NULL;
+  char anchor_buf[ANCHOR_BUF_SIZE];
+  int implicit_tag = 0, tag_applied = 0, i = 0, result = 0, err = 0, len = 0,
+      handled = 0;
+
+  frame->kind = FRAME_NONE;
+
+  /* Emit an alias if this object has already been emitted with an anchor */
+  if (ctx->anchors != NULL) {
+    anchor_entry = Ryaml_find_anchor(ctx, s_obj, 0);
+    if (anchor_entry != NULL && anchor_entry->count < 2) {
+      anchor_entry = NULL;
+    }
+    else if (anchor_entry != NULL && anchor_entry->id > 0) {
+      snprintf(anchor_buf, ANCHOR_BUF_SIZE, "id%03d", anchor_entry->id);
+      yaml_alias_event_initialize(event, (yaml_char_t *)anchor_buf);
+      return Ryaml_emit_event(ctx, 0, NULL);
+    }
+  }
+
+#if DEBUG
+  Rprintf("=== Emitting ===\n");
+  PrintValue(s_obj);
+#endif
+
+  /* Look for custom handler by class */
+  PROTECT(s_classes = Ryaml_get_classes(s_obj));
+  for (i = 0; i < length(s_classes); i++) {
+    PROTECT(s_class = STRING_ELT(s_classes, i));
+    klass = CHAR(s_class);
+    PROTECT(s_handler = Ryaml_find_handler(ctx->s_handlers, klass));
+    if (s_handler != R_NilValue) {
+      err = Ryaml_run_handler(s_handler, s_obj, &s_new_obj);
+
+      if (err != 0) {
+        warning("an error occurred when handling object of class '%s'; using default handler", klass);
+      }
+      else {
+        handled = 1;
+
+#if DEBUG
+        PROTECT(s_new_obj);
+        Rprintf("Result from custom handler:\n");
+        PrintValue(s_new_obj);
+        UNPROTECT(1);
+#endif
+      }
+    }
+    UNPROTECT(2); /* s_handler, s_class */
+
+    if (handled) {
+      break;
+    }
+  }
+  UNPROTECT(1); /* s_classes */
+
+  if (handled) {
+    s_obj = s_new_obj;
+  }
+
+  /* Deparse function objects first, since this operation creates a new object.
+   * Doing this here prevents having to reprotect an object later. */
+  if ((TYPEOF(s_obj) == CLOSXP || TYPEOF(s_obj) == SPECIALSXP ||
+      TYPEOF(s_obj) == BUILTINSXP)) {
 
     /* Deparse function into a string */
     PROTECT(s_new_obj = Ryaml_deparse_function(s_obj));
@@ -537,10 +1510,21 @@ static int emit_object(
     }
   }
 
+  /* Only collections can carry the anchor. If a handler turned the object
+   * into a scalar, it is emitted in full every time. */
+  if (anchor_entry != NULL && (TYPEOF(s_obj) == VECSXP ||
+        ((TYPEOF(s_obj) == LGLSXP || TYPEOF(s_obj) == INTSXP ||
+          TYPEOF(s_obj) == REALSXP || TYPEOF(s_obj) == STRSXP) &&
+         length(s_obj) != 1))) {
+    anchor_entry->id = ++ctx->last_anchor_id;
+    snprintf(anchor_buf, ANCHOR_BUF_SIZE, "id%03d", anchor_entry->id);
+    anchor = anchor_buf;
+  }
+
   switch (TYPEOF(s_obj)) {
     case NILSXP:
       /* NOTE: There is no way to tag NILSXP */
-      result = emit_nil(emitter, event, s_obj);
+      result = emit_nil(ctx, s_obj);
       break;
 
     /* atomic vector types */
@@ -548,16 +1532,18 @@ static int emit_object(
     case REALSXP:
     case INTSXP:
     case STRSXP:
-      /* TODO: add complex and raw */
+      /* TODO: add complex */
       len = length(s_obj);
 
       if (len != 1) {
         /* Apply tag to sequence */
         tag_applied = 1;
-        yaml_sequence_start_event_initialize(event, NULL, (yaml_char_t *)tag,
-            implicit_tag, YAML_ANY_SEQUENCE_STYLE);
+        yaml_sequence_start_event_initialize(event, (yaml_char_t *)anchor,
+            (yaml_char_t *)tag, implicit_tag,
+            ctx->flow_vectors >= 0 && len >= ctx->flow_vectors ?
+              YAML_FLOW_SEQUENCE_STYLE : YAML_ANY_SEQUENCE_STYLE);
 
-        result = yaml_emitter_emit(emitter, event);
+        result = Ryaml_emit_event(ctx, len == 0, NULL);
 
         if (!result) {
           break;
@@ -567,10 +1553,10 @@ static int emit_object(
       if (len >= 1) {
         if (Ryaml_has_class(s_obj, "factor")) {
           if (tag_applied) {
-            result = emit_factor(emitter, event, s_obj, NULL, 1);
+            result = emit_factor(ctx, s_obj, NULL, 1);
           }
           else {
-            result = emit_factor(emitter, event, s_obj, tag, implicit_tag);
+            result = emit_factor(ctx, s_obj, tag, implicit_tag);
           }
           if (!result) {
             break;
@@ -578,10 +1564,10 @@ static int emit_object(
         }
         else if (TYPEOF(s_obj) == STRSXP) {
           if (tag_applied) {
-            result = emit_string(emitter, event, s_obj, NULL, 1);
+            result = emit_string(ctx, s_obj, NULL, 1);
           }
           else {
-            result = emit_string(emitter, event, s_obj, tag, implicit_tag);
+            result = emit_string(ctx, s_obj, tag, implicit_tag);
           }
 
           if (!result) {
@@ -589,38 +1575,12 @@ static int emit_object(
           }
         }
         else {
-          switch(TYPEOF(s_obj)) {
-            case REALSXP:
-              s_new_obj = Ryaml_format_real(s_obj, precision);
-              break;
-
-            case INTSXP:
-              s_new_obj = Ryaml_format_int(s_obj);
-              break;
-
-            case LGLSXP:
-              s_new_obj = Ryaml_format_logical(s_obj);
-              break;
+          if (tag_applied) {
+            result = emit_formatted(ctx, s_obj, NULL, 1);
           }
-
-          PROTECT(s_new_obj);
-          for (i = 0; i < length(s_new_obj); i++) {
-            PROTECT(s_chr = STRING_ELT(s_new_obj, i));
-            if (tag_applied) {
-              result = emit_char(emitter, event, s_chr, NULL, 1,
-                  YAML_ANY_SCALAR_STYLE);
-            }
-            else {
-              result = emit_char(emitter, event, s_chr, tag, implicit_tag,
-                  YAML_ANY_SCALAR_STYLE);
-            }
-            UNPROTECT(1); /* s_chr */
-
-            if (!result) {
-              break;
-            }
+          else {
+            result = emit_formatted(ctx, s_obj, tag, implicit_tag);
           }
-          UNPROTECT(1); /* s_new_obj */
 
           if (!result) {
             break;
@@ -630,193 +1590,417 @@ static int emit_object(
 
       if (length(s_obj) != 1) {
         yaml_sequence_end_event_initialize(event);
-        result = yaml_emitter_emit(emitter, event);
+        result = Ryaml_emit_event(ctx, 0, NULL);
       }
       break;
 
-    case VECSXP:
-      if (Ryaml_has_class(s_obj, "data.frame") && length(s_obj) > 0 && !column_major) {
-        rows = length(VECTOR_ELT(s_obj, 0));
-        cols = length(s_obj);
-        PROTECT(s_names = GET_NAMES(s_obj));
-
-        yaml_sequence_start_event_initialize(event, NULL, (yaml_char_t *)tag,
-            implicit_tag, YAML_ANY_SEQUENCE_STYLE);
-        result = yaml_emitter_emit(emitter, event);
-
-        if (!result) {
-          UNPROTECT(1); /* s_names */
-          break;
-        }
-
-        for (i = 0; i < rows; i++) {
-          yaml_mapping_start_event_initialize(event, NULL, NULL, 1,
-              YAML_ANY_MAPPING_STYLE);
-          result = yaml_emitter_emit(emitter, event);
-
-          if (!result) {
-            break;
-          }
-
-          for (j = 0; j < cols; j++) {
-            PROTECT(s_chr = STRING_ELT(s_names, j));
-            result = emit_char(emitter, event, s_chr, NULL, 1,
-                Ryaml_string_style(s_chr));
-            UNPROTECT(1);
-
-            if (!result) {
-              break;
-            }
-
-            /* Need to create a vector of size one, then emit it */
-            PROTECT(s_elt = VECTOR_ELT(s_obj, j));
-            PROTECT(s_tmp = Ryaml_yoink(s_elt, i));
-            result = emit_object(emitter, event, s_tmp, omap, column_major,
-                precision, s_handlers);
-            UNPROTECT(2);
-
-            if (!result) {
-              break;
-            }
-          }
-
-          if (result) {
-            yaml_mapping_end_event_initialize(event);
-            result = yaml_emitter_emit(emitter, event);
-          }
-
-          if (!result) {
-            break;
-          }
-        }
-
-        if (result) {
-          yaml_sequence_end_event_initialize(event);
-          result = yaml_emitter_emit(emitter, event);
-        }
+    case RAWSXP:
+      result = emit_binary(ctx, s_obj, tag);
+      break;
 
-        UNPROTECT(1); /* s_names */
+    case VECSXP:
+      if (Ryaml_has_class(s_obj, "data.frame") && length(s_obj) > 0 && !ctx->column_major) {
+        result = emit_data_frame_rows(ctx, s_obj, anchor, tag, implicit_tag);
       }
       else if (Ryaml_is_named_list(s_obj)) {
-        if (omap) {
+        if (ctx->omap) {
           if (tag == NULL) {
             tag = "tag:yaml.org,2002:omap";
             implicit_tag = 0;
           }
 
-          yaml_sequence_start_event_initialize(event, NULL, (yaml_char_t *)tag,
-              implicit_tag, YAML_ANY_SEQUENCE_STYLE);
-
-          result = yaml_emitter_emit(emitter, event);
+          yaml_sequence_start_event_initialize(event, (yaml_char_t *)anchor,
+              (yaml_char_t *)tag, implicit_tag, YAML_ANY_SEQUENCE_STYLE);
+          frame->kind = FRAME_OMAP;
         }
         else {
-          yaml_mapping_start_event_initialize(event, NULL, (yaml_char_t *)tag,
-              implicit_tag, YAML_ANY_MAPPING_STYLE);
-
-          result = yaml_emitter_emit(emitter, event);
+          yaml_mapping_start_event_initialize(event, (yaml_char_t *)anchor,
+              (yaml_char_t *)tag, implicit_tag, YAML_ANY_MAPPING_STYLE);
+          frame->kind = FRAME_MAP;
         }
+        result = Ryaml_emit_event(ctx, length(s_obj) == 0, NULL);
+      }
+      else {
+        yaml_sequence_start_event_initialize(event, (yaml_char_t *)anchor,
+            (yaml_char_t *)tag, implicit_tag, YAML_ANY_SEQUENCE_STYLE);
+        frame->kind = FRAME_SEQ;
+        result = Ryaml_emit_event(ctx, length(s_obj) == 0, NULL);
+      }
 
-        if (!result) {
-          break;
-        }
-
-        PROTECT(s_names = GET_NAMES(s_obj));
-        for (i = 0; i < length(s_obj); i++) {
-          if (omap) {
-            yaml_mapping_start_event_initialize(event, NULL, NULL, 1,
-                YAML_ANY_MAPPING_STYLE);
-
-            result = yaml_emitter_emit(emitter, event);
-
-            if (!result) {
-              break;
-            }
-          }
-
-          PROTECT(s_chr = STRING_ELT(s_names, i));
-          result = emit_char(emitter, event, s_chr, NULL, 1,
-              Ryaml_string_style(s_chr));
-          UNPROTECT(1);
+      if (frame->kind != FRAME_NONE) {
+        frame->s_obj = s_obj;
+        frame->index = 0;
+        frame->length = length(s_obj);
+      }
+      break;
 
-          if (!result) {
-            break;
-          }
+    default:
+      PROTECT(s_type = type2str(TYPEOF(s_obj)));
+      PROTECT(s_classes = GET_CLASS(s_obj));
+      if (TYPEOF(s_classes) != STRSXP || LENGTH(s_classes) == 0) {
+        Ryaml_set_error_msg(ctx->error_ctx, "don't know how to emit object of type: '%s'\n", CHAR(s_type));
+      }
+      else {
+        PROTECT(s_inspect = Ryaml_inspect(s_classes));
+        inspect = CHAR(STRING_ELT(s_inspect, 0));
+        Ryaml_set_error_msg(ctx->error_ctx, "don't know how to emit object of type: '%s', class: %s\n", CHAR(s_type), inspect);
+        UNPROTECT(1); /* s_inspect */
+      }
+      UNPROTECT(2); /* s_type, s_classes */
+      result = 0;
+  }
 
-          PROTECT(s_elt = VECTOR_ELT(s_obj, i));
-          result = emit_object(emitter, event, s_elt, omap, column_major,
-              precision, s_handlers);
-          UNPROTECT(1);
+  UNPROTECT(2); /* s_obj, s_tag */
+  return result;
+}
 
-          if (result && omap) {
-            yaml_mapping_end_event_initialize(event);
-            result = yaml_emitter_emit(emitter, event);
-          }
 
-          if (!result) {
-            break;
-          }
-        }
+/* Make room for another frame on the emit stack */
+static void Ryaml_grow_emit_stack(s_emit_stack *stack)
+{
+  s_emit_frame *frames = NULL;
+  SEXP s_objs = NULL;
+  int i = 0;
 
-        if (result) {
-          if (omap) {
-            yaml_sequence_end_event_initialize(event);
-          }
-          else {
-            yaml_mapping_end_event_initialize(event);
-          }
+  frames = (s_emit_frame *)R_alloc(stack->size * 2, sizeof(s_emit_frame));
+  memcpy(frames, stack->frames, sizeof(s_emit_frame) * stack->size);
+  stack->frames = frames;
 
-          result = yaml_emitter_emit(emitter, event);
-        }
+  PROTECT(s_objs = allocVector(VECSXP, stack->size * 2));
+  for (i = 0; i < stack->size; i++) {
+    SET_VECTOR_ELT(s_objs, i, VECTOR_ELT(stack->s_objs, i));
+  }
+  REPROTECT(stack->s_objs = s_objs, stack->s_objs_index);
+  UNPROTECT(1); /* s_objs */
 
-        UNPROTECT(1); /* s_names */
-      }
-      else {
-        yaml_sequence_start_event_initialize(event, NULL, (yaml_char_t *)tag,
-            implicit_tag, YAML_ANY_SEQUENCE_STYLE);
-        result = yaml_emitter_emit(emitter, event);
+  stack->size *= 2;
+}
 
-        if (!result) {
-          break;
-        }
+/* Emit the end of a list, or of an omap pair once its value is done */
+static int emit_frame_end(
+  s_emitter_context *ctx,
+  e_frame_kind kind)
+{
+  switch (kind) {
+    case FRAME_MAP:
+    case FRAME_OMAP_PAIR:
+      yaml_mapping_end_event_initialize(ctx->event);
+      break;
 
-        for (i = 0; i < length(s_obj); i++) {
-          PROTECT(s_elt = VECTOR_ELT(s_obj, i));
-          result = emit_object(emitter, event, s_elt, omap, column_major,
-              precision, s_handlers);
-          UNPROTECT(1);
+    default:
+      yaml_sequence_end_event_initialize(ctx->event);
+      break;
+  }
 
-          if (!result) {
-            break;
-          }
-        }
+  return Ryaml_emit_event(ctx, 0, NULL);
+}
 
-        yaml_sequence_end_event_initialize(event);
-        result = yaml_emitter_emit(emitter, event);
+/* Emit an object. Lists are walked with a heap-allocated stack instead of by
+ * recursion, so nesting depth is only limited by memory. The lists on the
+ * stack are kept alive by storing them in stack.s_objs. */
+static int emit_object(
+  s_emitter_context *ctx,
+  SEXP s_obj)
+{
+  SEXP s_elt = NULL;
+  s_emit_stack stack;
+  s_emit_frame frame, *top = NULL;
+  int result = 0, i = 0;
+
+  result = emit_node(ctx, s_obj, &frame);
+  if (!result || frame.kind == FRAME_NONE) {
+    return result;
+  }
+
+  /* frame.s_obj may be a handler's result, which nothing else keeps
+   * alive while the stack is allocated */
+  PROTECT(frame.s_obj);
+  stack.size = EMIT_STACK_INITIAL_SIZE;
+  stack.depth = 0;
+  stack.frames = (s_emit_frame *)R_alloc(stack.size, sizeof(s_emit_frame));
+  PROTECT_WITH_INDEX(stack.s_objs = allocVector(VECSXP, stack.size),
+      &stack.s_objs_index);
+
+  stack.frames[0] = frame;
+  SET_VECTOR_ELT(stack.s_objs, 0, frame.s_obj);
+  stack.depth = 1;
+
+  while (result && stack.depth > 0) {
+    top = &stack.frames[stack.depth - 1];
+
+    if (top->index >= top->length) {
+      result = emit_frame_end(ctx, top->kind);
+      SET_VECTOR_ELT(stack.s_objs, stack.depth - 1, R_NilValue);
+      stack.depth--;
+
+      if (result && stack.depth > 0 &&
+          stack.frames[stack.depth - 1].kind == FRAME_OMAP) {
+        result = emit_frame_end(ctx, FRAME_OMAP_PAIR);
       }
+      continue;
+    }
+
+    i = top->index++;
+    if (top->kind == FRAME_OMAP) {
+      yaml_mapping_start_event_initialize(ctx->event, NULL, NULL, 1,
+          YAML_ANY_MAPPING_STYLE);
+      result = Ryaml_emit_event(ctx, 0, NULL);
+    }
+    if (result && (top->kind == FRAME_MAP || top->kind == FRAME_OMAP)) {
+      result = emit_key(ctx, STRING_ELT(GET_NAMES(top->s_obj), i));
+    }
+    if (!result) {
       break;
+    }
 
-    default:
-      PROTECT(s_type = type2str(TYPEOF(s_obj)));
-      PROTECT(s_classes = GET_CLASS(s_obj));
-      if (TYPEOF(s_classes) != STRSXP || LENGTH(s_classes) == 0) {
-        Ryaml_set_error_msg("don't know how to emit object of type: '%s'\n", CHAR(s_type));
+    s_elt = VECTOR_ELT(top->s_obj, i);
+    result = emit_node(ctx, s_elt, &frame);
+    if (!result) {
+      break;
+    }
+
+    if (frame.kind == FRAME_NONE) {
+      if (top->kind == FRAME_OMAP) {
+        result = emit_frame_end(ctx, FRAME_OMAP_PAIR);
       }
-      else {
-        PROTECT(s_inspect = Ryaml_inspect(s_classes));
-        inspect = CHAR(STRING_ELT(s_inspect, 0));
-        Ryaml_set_error_msg("don't know how to emit object of type: '%s', class: %s\n", CHAR(s_type), inspect);
-        UNPROTECT(1); /* s_inspect */
+      continue;
+    }
+
+    if (stack.depth == stack.size) {
+      /* Growing allocates, so frame.s_obj has to be protected meanwhile */
+      PROTECT(frame.s_obj);
+      Ryaml_grow_emit_stack(&stack);
+      UNPROTECT(1);
+    }
+    stack.frames[stack.depth] = frame;
+    SET_VECTOR_ELT(stack.s_objs, stack.depth, frame.s_obj);
+    stack.depth++;
+  }
+
+  UNPROTECT(2); /* stack.s_objs, first frame.s_obj */
+  return result;
+}
+
+/* Emit a chunk of the top-level list as a document of its own, on a worker
+ * thread. The chunk's text is exactly what the main emitter would have
+ * written for it, because the top-level list is never indented: only the
+ * first chunk writes the list's tag and anchor, and only the last one ends
+ * the stream. */
+static int Ryaml_emit_chunk(s_emit_chunk *chunk, s_event_log *log)
+{
+  yaml_emitter_t *emitter = &chunk->emitter;
+  yaml_event_t event, *root = &log->events[0].event;
+  s_recorded_event *recorded = NULL;
+  size_t i = 0;
+
+  yaml_stream_start_event_initialize(&event, YAML_ANY_ENCODING);
+  if (!yaml_emitter_emit_hinted(emitter, &event, 0, NULL)) {
+    return 0;
+  }
+
+  yaml_document_start_event_initialize(&event, NULL, NULL, NULL, 1);
+  if (!yaml_emitter_emit_hinted(emitter, &event, 0, NULL)) {
+    return 0;
+  }
+
+  if (root->type == YAML_SEQUENCE_START_EVENT) {
+    yaml_sequence_start_event_initialize(&event,
+        chunk->is_first ? root->data.sequence_start.anchor : NULL,
+        chunk->is_first ? root->data.sequence_start.tag : NULL,
+        chunk->is_first ? root->data.sequence_start.implicit : 1,
+        root->data.sequence_start.style);
+  }
+  else {
+    yaml_mapping_start_event_initialize(&event,
+        chunk->is_first ? root->data.mapping_start.anchor : NULL,
+        chunk->is_first ? root->data.mapping_start.tag : NULL,
+        chunk->is_first ? root->data.mapping_start.implicit : 1,
+        root->data.mapping_start.style);
+  }
+  if (!yaml_emitter_emit_hinted(emitter, &event, 0, NULL)) {
+    return 0;
+  }
+
+  for (i = chunk->first; i < chunk->last; i++) {
+    recorded = &log->events[i];
+    if (!yaml_emitter_emit_hinted(emitter, &recorded->event, recorded->empty,
+          recorded->has_analysis ? &recorded->analysis : NULL)) {
+      return 0;
+    }
+  }
+
+  if (root->type == YAML_SEQUENCE_START_EVENT) {
+    yaml_sequence_end_event_initialize(&event);
+  }
+  else {
+    yaml_mapping_end_event_initialize(&event);
+  }
+  if (!yaml_emitter_emit_hinted(emitter, &event, 0, NULL)) {
+    return 0;
+  }
+
+  yaml_document_end_event_initialize(&event, 1);
+  if (!yaml_emitter_emit_hinted(emitter, &event, 0, NULL)) {
+    return 0;
+  }
+
+  if (chunk->is_last) {
+    yaml_stream_end_event_initialize(&event);
+    return yaml_emitter_emit_hinted(emitter, &event, 0, NULL);
+  }
+
+  return 1;
+}
+
+/* Split a recorded block sequence or mapping into one chunk per thread, at
+ * element boundaries. Returns the number of chunks, or 0 if the log isn't a
+ * large enough collection to be worth splitting. */
+static int Ryaml_split_event_log(
+  s_emitter_context *ctx,
+  s_event_log *log,
+  s_emit_chunk *chunks)
+{
+  yaml_event_t *root = NULL, *event = NULL;
+  size_t i = 0, target = 0, elements = 0;
+  int mapping = 0, depth = 0, nodes = 0, count = 0;
+
+  if (log->count < 2) {
+    return 0;
+  }
+
+  root = &log->events[0].event;
+  if (root->type == YAML_SEQUENCE_START_EVENT) {
+    if (root->data.sequence_start.style == YAML_FLOW_SEQUENCE_STYLE) {
+      return 0;
+    }
+  }
+  else if (root->type == YAML_MAPPING_START_EVENT) {
+    if (root->data.mapping_start.style == YAML_FLOW_MAPPING_STYLE) {
+      return 0;
+    }
+    mapping = 1;
+  }
+  else {
+    return 0;
+  }
+
+  /* The last event ends the root collection */
+  target = (log->count - 2) / ctx->threads + 1;
+  chunks[0].first = 1;
+  for (i = 1; i < log->count - 1; i++) {
+    event = &log->events[i].event;
+    switch (event->type) {
+      case YAML_SEQUENCE_START_EVENT:
+      case YAML_MAPPING_START_EVENT:
+        depth++;
+        break;
+
+      case YAML_SEQUENCE_END_EVENT:
+      case YAML_MAPPING_END_EVENT:
+        depth--;
+        break;
+
+      default:
+        break;
+    }
+    if (depth > 0) {
+      continue;
+    }
+
+    /* A mapping's elements are key/value pairs */
+    nodes++;
+    if (mapping && nodes % 2 == 1) {
+      continue;
+    }
+    elements++;
+
+    if (count < ctx->threads - 1 && i + 1 - chunks[count].first >= target) {
+      chunks[count].last = i + 1;
+      chunks[++count].first = i + 1;
+    }
+  }
+  chunks[count].last = log->count - 1;
+  count++;
+
+  if (elements < PARALLEL_LIST_MIN_LENGTH || count < 2) {
+    return 0;
+  }
+
+  return count;
+}
+
+/* Emit the recorded events. A large top-level list is split into chunks
+ * that are emitted on separate threads and then written out in order;
+ * anything else is passed to the main emitter. Sets *finished if the chunks
+ * ended the stream. */
+static int Ryaml_emit_event_log(
+  s_emitter_context *ctx,
+  s_event_log *log,
+  s_emitter_output *output,
+  int *finished)
+{
+  s_emit_chunk *chunks = NULL, *chunk = NULL;
+  s_recorded_event *recorded = NULL;
+  size_t i = 0;
+  int count = 0, result = 1, j = 0;
+
+  chunks = (s_emit_chunk *)R_alloc(ctx->threads, sizeof(s_emit_chunk));
+  memset(chunks, 0, sizeof(s_emit_chunk) * ctx->threads);
+  count = Ryaml_split_event_log(ctx, log, chunks);
+
+  if (count == 0) {
+    for (i = 0; result && i < log->count; i++) {
+      recorded = &log->events[i];
+      result = yaml_emitter_emit_hinted(ctx->emitter, &recorded->event,
+          recorded->empty, recorded->has_analysis ? &recorded->analysis : NULL);
+    }
+    return result;
+  }
+
+  for (j = 0; j < count; j++) {
+    chunk = &chunks[j];
+    chunk->is_first = j == 0;
+    chunk->is_last = j == count - 1;
+    yaml_emitter_initialize(&chunk->emitter);
+    yaml_emitter_set_unicode(&chunk->emitter, ctx->emitter->unicode);
+    yaml_emitter_set_break(&chunk->emitter, ctx->emitter->line_break);
+    yaml_emitter_set_indent(&chunk->emitter, ctx->emitter->best_indent);
+    yaml_emitter_set_indent_mapping_sequence(&chunk->emitter,
+        ctx->emitter->indent_mapping_sequence);
+    yaml_emitter_set_output(&chunk->emitter,
+        Ryaml_serialize_to_yaml_write_handler, &chunk->output);
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(ctx->threads) schedule(dynamic)
+#endif
+  for (j = 0; j < count; j++) {
+    chunks[j].status = Ryaml_emit_chunk(&chunks[j], log);
+  }
+
+  for (j = 0; j < count; j++) {
+    chunk = &chunks[j];
+    if (result && !chunk->status) {
+      if (chunk->emitter.problem != NULL) {
+        Ryaml_set_error_msg(ctx->error_ctx, "Emitter error: %s", chunk->emitter.problem);
       }
-      UNPROTECT(2); /* s_type, s_classes */
       result = 0;
+    }
+    if (result) {
+      result = Ryaml_serialize_to_yaml_write_handler(output,
+          (unsigned char *)chunk->output.buffer, chunk->output.size);
+    }
+    yaml_emitter_delete(&chunk->emitter);
+    free(chunk->output.buffer);
   }
+  *finished = result;
 
-  UNPROTECT(2); /* s_obj, s_tag */
   return result;
 }
 
-SEXP Ryaml_serialize_to_yaml(
-  SEXP s_obj,
+/* Check the emitter options passed in from R */
+static void Ryaml_get_emitter_options(
+  s_emitter_options *options,
   SEXP s_line_sep,
   SEXP s_indent,
   SEXP s_omap,
@@ -824,150 +2008,524 @@ SEXP Ryaml_serialize_to_yaml(
   SEXP s_unicode,
   SEXP s_precision,
   SEXP s_indent_mapping_sequence,
-  SEXP s_handlers)
+  SEXP s_flow_vectors,
+  SEXP s_anchors,
+  SEXP s_threads)
 {
-  SEXP s_retval = NULL;
-  yaml_emitter_t emitter;
-  yaml_event_t event;
-  s_emitter_output output;
-  int status = 0, line_sep = 0, indent = 0, omap = 0, column_major = 0,
-      unicode = 0, precision = 0, indent_mapping_sequence = 0;
   const char *c_line_sep = NULL;
 
+  memset(options, 0, sizeof(s_emitter_options));
+
   c_line_sep = CHAR(STRING_ELT(s_line_sep, 0));
   if (c_line_sep[0] == '\n') {
-    line_sep = YAML_LN_BREAK;
+    options->line_sep = YAML_LN_BREAK;
   }
   else if (c_line_sep[0] == '\r') {
     if (c_line_sep[1] == '\n') {
-      line_sep = YAML_CRLN_BREAK;
+      options->line_sep = YAML_CRLN_BREAK;
     }
     else {
-      line_sep = YAML_CR_BREAK;
+      options->line_sep = YAML_CR_BREAK;
     }
   }
   else {
     error("argument `line.sep` must be a either '\n', '\r\n', or '\r'");
-    return R_NilValue;
+    return;
   }
 
   if (isNumeric(s_indent) && length(s_indent) == 1) {
     s_indent = coerceVector(s_indent, INTSXP);
-    indent = INTEGER(s_indent)[0];
+    options->indent = INTEGER(s_indent)[0];
   }
   else if (isInteger(s_indent) && length(s_indent) == 1) {
-    indent = INTEGER(s_indent)[0];
+    options->indent = INTEGER(s_indent)[0];
   }
   else {
     error("argument `indent` must be a numeric or integer vector of length 1");
-    return R_NilValue;
+    return;
   }
 
-  if (indent <= 0) {
+  if (options->indent <= 0) {
     error("argument `indent` must be greater than 0");
-    return R_NilValue;
+    return;
   }
 
   if (!isLogical(s_omap) || length(s_omap) != 1) {
     error("argument `omap` must be either TRUE or FALSE");
-    return R_NilValue;
+    return;
   }
-  omap = LOGICAL(s_omap)[0];
+  options->omap = LOGICAL(s_omap)[0];
 
   if (!isLogical(s_column_major) || length(s_column_major) != 1) {
     error("argument `column.major` must be either TRUE or FALSE");
-    return R_NilValue;
+    return;
   }
-  column_major = LOGICAL(s_column_major)[0];
+  options->column_major = LOGICAL(s_column_major)[0];
 
   if (!isLogical(s_unicode) || length(s_unicode) != 1) {
     error("argument `unicode` must be either TRUE or FALSE");
-    return R_NilValue;
+    return;
   }
-  unicode = LOGICAL(s_unicode)[0];
+  options->unicode = LOGICAL(s_unicode)[0];
 
-  if (isNumeric(s_precision) && length(s_precision) == 1) {
-    s_precision = coerceVector(s_precision, INTSXP);
-    precision = INTEGER(s_precision)[0];
-  }
-  else if (isInteger(s_precision) && length(s_precision) == 1) {
-    precision = INTEGER(s_precision)[0];
+  if (isString(s_precision) && length(s_precision) == 1 &&
+      strcmp(CHAR(STRING_ELT(s_precision, 0)), "shortest") == 0) {
+    options->precision = PRECISION_SHORTEST;
   }
   else {
-    error("argument `precision` must be a numeric or integer vector of length 1");
-    return R_NilValue;
-  }
-  if (precision < 1 || precision > 22) {
-    error("argument `precision` must be in the range 1..22");
+    if (isNumeric(s_precision) && length(s_precision) == 1) {
+      s_precision = coerceVector(s_precision, INTSXP);
+      options->precision = INTEGER(s_precision)[0];
+    }
+    else if (isInteger(s_precision) && length(s_precision) == 1) {
+      options->precision = INTEGER(s_precision)[0];
+    }
+    else {
+      error("argument `precision` must be a numeric or integer vector of length 1, or \"shortest\"");
+      return;
+    }
+    if (options->precision < 1 || options->precision > 22) {
+      error("argument `precision` must be in the range 1..22");
+    }
   }
 
   if (!isLogical(s_indent_mapping_sequence) || length(s_indent_mapping_sequence) != 1) {
     error("argument `indent.mapping.sequence` must be either TRUE or FALSE");
-    return R_NilValue;
+    return;
   }
-  indent_mapping_sequence = LOGICAL(s_indent_mapping_sequence)[0];
+  options->indent_mapping_sequence = LOGICAL(s_indent_mapping_sequence)[0];
 
-  PROTECT(s_handlers = Ryaml_sanitize_handlers(s_handlers));
+  if (isLogical(s_flow_vectors) && length(s_flow_vectors) == 1 &&
+      LOGICAL(s_flow_vectors)[0] != NA_LOGICAL) {
+    options->flow_vectors = LOGICAL(s_flow_vectors)[0] ? 0 : -1;
+  }
+  else if (isNumeric(s_flow_vectors) && length(s_flow_vectors) == 1) {
+    s_flow_vectors = coerceVector(s_flow_vectors, INTSXP);
+    options->flow_vectors = INTEGER(s_flow_vectors)[0];
+    if (options->flow_vectors == NA_INTEGER || options->flow_vectors < 0) {
+      error("argument `flow.vectors` must be either TRUE, FALSE or a non-negative number");
+      return;
+    }
+  }
+  else {
+    error("argument `flow.vectors` must be either TRUE, FALSE or a non-negative number");
+    return;
+  }
+
+  if (!isLogical(s_anchors) || length(s_anchors) != 1) {
+    error("argument `anchors` must be either TRUE or FALSE");
+    return;
+  }
+  options->anchors = LOGICAL(s_anchors)[0];
+
+  if (isNumeric(s_threads) && length(s_threads) == 1) {
+    s_threads = coerceVector(s_threads, INTSXP);
+    options->threads = INTEGER(s_threads)[0];
+  }
+  if (options->threads == NA_INTEGER || options->threads < 1) {
+    error("argument `threads` must be a positive number");
+    return;
+  }
+#ifndef _OPENMP
+  options->threads = 1;
+#endif
+}
+
+static void Ryaml_init_emitter(
+  yaml_emitter_t *emitter,
+  s_emitter_options *options,
+  s_emitter_output *output)
+{
+  yaml_emitter_initialize(emitter);
+  yaml_emitter_set_unicode(emitter, options->unicode);
+  yaml_emitter_set_break(emitter, options->line_sep);
+  yaml_emitter_set_indent(emitter, options->indent);
+  yaml_emitter_set_indent_mapping_sequence(emitter, options->indent_mapping_sequence);
+  yaml_emitter_set_output(emitter, Ryaml_serialize_to_yaml_write_handler, output);
+}
+
+/* Build the call that writes emitter output to a connection:
+ * cat(<chunk>, file = s_connection, sep = "") */
+static SEXP Ryaml_connection_call(SEXP s_connection)
+{
+  SEXP s_call = NULL;
+
+  PROTECT(s_call = lang4(Ryaml_CatFunc, R_NilValue, s_connection, mkString("")));
+  SET_TAG(CDDR(s_call), install("file"));
+  SET_TAG(CDR(CDDR(s_call)), install("sep"));
+  UNPROTECT(1);
+
+  return s_call;
+}
+
+/* Set the error message for a failed emitter, unless the code that failed
+ * already set a more specific one */
+static void Ryaml_set_emitter_error(yaml_emitter_t *emitter, s_error_context *error_ctx)
+{
+  if (error_ctx->msg[0] != 0) {
+    return;
+  }
+
+  if (emitter->problem != NULL) {
+    Ryaml_set_error_msg(error_ctx, "Emitter error: %s", emitter->problem);
+  }
+  else {
+    Ryaml_set_error_msg(error_ctx, "Unknown emitter error");
+  }
+}
+
+/* Return 1 if s_obj would be emitted as a block collection with enough
+ * elements to be split across threads. Anything else is emitted directly,
+ * since recording it would only hold the whole document in memory. */
+static int Ryaml_is_parallel_list(s_emitter_context *ctx, SEXP s_obj)
+{
+  SEXP s_classes = NULL;
+  int i = 0, len = 0, handled = 0;
+
+  if (TYPEOF(s_obj) != VECSXP) {
+    return 0;
+  }
+
+  /* A handler may replace the list with something else entirely */
+  PROTECT(s_classes = Ryaml_get_classes(s_obj));
+  for (i = 0; !handled && i < length(s_classes); i++) {
+    handled = Ryaml_find_handler(ctx->s_handlers,
+        CHAR(STRING_ELT(s_classes, i))) != R_NilValue;
+  }
+  UNPROTECT(1); /* s_classes */
+  if (handled) {
+    return 0;
+  }
+
+  len = length(s_obj);
+  if (len > 0 && !ctx->column_major && Ryaml_has_class(s_obj, "data.frame")) {
+    len = length(VECTOR_ELT(s_obj, 0));
+  }
+
+  return len >= PARALLEL_LIST_MIN_LENGTH;
+}
+
+/* Emit one document containing s_obj. If finished is not NULL, a large
+ * top-level list may be emitted in parallel (see Ryaml_emit_event_log), in
+ * which case *finished is set once the stream has been ended as well. */
+static int Ryaml_emit_document(
+  yaml_emitter_t *emitter,
+  s_emitter_options *options,
+  SEXP s_handlers,
+  SEXP s_obj,
+  int implicit_start,
+  s_emitter_output *output,
+  int *finished,
+  s_error_context *error_ctx)
+{
+  yaml_event_t event;
+  s_emitter_context ctx;
+  s_event_log log;
+  int status = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.emitter = emitter;
+  ctx.event = &event;
+  ctx.omap = options->omap;
+  ctx.column_major = options->column_major;
+  ctx.precision = options->precision;
+  ctx.flow_vectors = options->flow_vectors;
+  ctx.threads = options->threads;
+  ctx.s_handlers = s_handlers;
+  ctx.error_ctx = error_ctx;
+  PROTECT_WITH_INDEX(ctx.s_style_keys = R_NilValue, &ctx.style_keys_index);
+  if (options->anchors) {
+    Ryaml_count_anchors(&ctx, s_obj);
+  }
+
+  yaml_document_start_event_initialize(&event, NULL, NULL, NULL, implicit_start);
+  status = yaml_emitter_emit_hinted(emitter, &event, 0, NULL);
+
+  /* With several threads, a large list is first turned into events on this
+   * thread, so that the emitters running on the other threads never need to
+   * look at the R object */
+  memset(&log, 0, sizeof(log));
+  if (status && finished != NULL && options->threads > 1 &&
+      Ryaml_is_parallel_list(&ctx, s_obj)) {
+    ctx.log = &log;
+  }
+  if (status) {
+    status = emit_object(&ctx, s_obj);
+  }
+  if (status && ctx.log != NULL) {
+    ctx.log = NULL;
+    status = Ryaml_emit_event_log(&ctx, &log, output, finished);
+  }
+  Ryaml_free_event_log(&log);
+
+  if (status && (finished == NULL || !*finished)) {
+    yaml_document_end_event_initialize(&event, 1);
+    status = yaml_emitter_emit_hinted(emitter, &event, 0, NULL);
+  }
+
+  UNPROTECT(1); /* ctx.s_style_keys */
+  return status;
+}
+
+/* Check the emitter options without emitting anything, so that a file isn't
+ * opened for writing (and emptied) only to find that the options are bad */
+SEXP Ryaml_check_emitter_options(
+  SEXP s_line_sep,
+  SEXP s_indent,
+  SEXP s_omap,
+  SEXP s_column_major,
+  SEXP s_unicode,
+  SEXP s_precision,
+  SEXP s_indent_mapping_sequence,
+  SEXP s_flow_vectors,
+  SEXP s_anchors,
+  SEXP s_threads)
+{
+  s_emitter_options options;
+
+  Ryaml_get_emitter_options(&options, s_line_sep, s_indent, s_omap,
+      s_column_major, s_unicode, s_precision, s_indent_mapping_sequence,
+      s_flow_vectors, s_anchors, s_threads);
+
+  return R_NilValue;
+}
+
+SEXP Ryaml_serialize_to_yaml(
+  SEXP s_obj,
+  SEXP s_line_sep,
+  SEXP s_indent,
+  SEXP s_omap,
+  SEXP s_column_major,
+  SEXP s_unicode,
+  SEXP s_precision,
+  SEXP s_indent_mapping_sequence,
+  SEXP s_handlers,
+  SEXP s_flow_vectors,
+  SEXP s_anchors,
+  SEXP s_threads,
+  SEXP s_connection)
+{
+  SEXP s_retval = NULL;
+  yaml_emitter_t emitter;
+  yaml_event_t event;
+  s_emitter_output output;
+  s_emitter_options options;
+  s_error_context error_ctx;
+  int finished = 0, status = 0;
 
-  yaml_emitter_initialize(&emitter);
-  yaml_emitter_set_unicode(&emitter, unicode);
-  yaml_emitter_set_break(&emitter, line_sep);
-  yaml_emitter_set_indent(&emitter, indent);
-  yaml_emitter_set_indent_mapping_sequence(&emitter, indent_mapping_sequence);
+  Ryaml_get_emitter_options(&options, s_line_sep, s_indent, s_omap,
+      s_column_major, s_unicode, s_precision, s_indent_mapping_sequence,
+      s_flow_vectors, s_anchors, s_threads);
+
+  PROTECT(s_handlers = Ryaml_sanitize_handlers(s_handlers));
+  error_ctx.msg[0] = 0;
 
   output.buffer = NULL;
   output.size = output.capa = 0;
-  yaml_emitter_set_output(&emitter, Ryaml_serialize_to_yaml_write_handler, &output);
+  output.s_call = NULL;
+  if (!isNull(s_connection)) {
+    output.s_call = Ryaml_connection_call(s_connection);
+  }
+  PROTECT(output.s_call);
+  Ryaml_init_emitter(&emitter, &options, &output);
 
   yaml_stream_start_event_initialize(&event, YAML_ANY_ENCODING);
-  status = yaml_emitter_emit(&emitter, &event);
-  if (!status)
-    goto done;
-
-  yaml_document_start_event_initialize(&event, NULL, NULL, NULL, 1);
-  status = yaml_emitter_emit(&emitter, &event);
-  if (!status)
-    goto done;
-
-  status = emit_object(&emitter, &event, s_obj, omap, column_major, precision, s_handlers);
+  status = yaml_emitter_emit_hinted(&emitter, &event, 0, NULL);
   if (!status)
     goto done;
 
-  yaml_document_end_event_initialize(&event, 1);
-  status = yaml_emitter_emit(&emitter, &event);
-  if (!status)
+  status = Ryaml_emit_document(&emitter, &options, s_handlers, s_obj, 1,
+      &output, &finished, &error_ctx);
+  if (!status || finished)
     goto done;
 
   yaml_stream_end_event_initialize(&event);
-  status = yaml_emitter_emit(&emitter, &event);
+  status = yaml_emitter_emit_hinted(&emitter, &event, 0, NULL);
 
 done:
 
-  UNPROTECT(1); /* s_handlers */
+  UNPROTECT(2); /* s_handlers, output.s_call */
 
-  if (status) {
+  if (status && output.s_call != NULL) {
+    s_retval = R_NilValue;
+  }
+  else if (status) {
     PROTECT(s_retval = allocVector(STRSXP, 1));
     SET_STRING_ELT(s_retval, 0, mkCharLen(output.buffer, output.size));
     UNPROTECT(1);
   }
   else {
-    if (emitter.problem != NULL) {
-      Ryaml_set_error_msg("Emitter error: %s", emitter.problem);
-    }
-    else {
-      Ryaml_set_error_msg("Unknown emitter error");
-    }
+    Ryaml_set_emitter_error(&emitter, &error_ctx);
     s_retval = R_NilValue;
   }
 
   yaml_emitter_delete(&emitter);
+  free(output.buffer);
 
-  if (status) {
-    free(output.buffer);
-  }
-  else {
-    error("%s", Ryaml_error_msg);
+  if (!status) {
+    Ryaml_raise_error(&error_ctx, NULL);
   }
 
   return s_retval;
 }
+
+/* A writer keeps one emitter and its connection open across calls, so that
+ * documents can be added to a stream one at a time */
+typedef struct {
+  yaml_emitter_t emitter;
+  s_emitter_output output;
+  s_emitter_options options;
+  int explicit_start;
+  int documents;
+  int open;
+} s_yaml_writer;
+
+static void Ryaml_close_writer(s_yaml_writer *writer)
+{
+  if (writer->open) {
+    yaml_emitter_delete(&writer->emitter);
+    free(writer->output.buffer);
+    writer->open = 0;
+  }
+}
+
+static void Ryaml_finalize_writer(SEXP s_writer)
+{
+  s_yaml_writer *writer = (s_yaml_writer *)R_ExternalPtrAddr(s_writer);
+
+  if (writer != NULL) {
+    Ryaml_close_writer(writer);
+    free(writer);
+    R_ClearExternalPtr(s_writer);
+  }
+}
+
+static s_yaml_writer *Ryaml_get_writer(SEXP s_writer)
+{
+  s_yaml_writer *writer = NULL;
+
+  if (TYPEOF(s_writer) == EXTPTRSXP) {
+    writer = (s_yaml_writer *)R_ExternalPtrAddr(s_writer);
+  }
+  if (writer == NULL || !writer->open) {
+    error("the YAML writer is closed");
+  }
+
+  return writer;
+}
+
+SEXP Ryaml_open_yaml_writer(
+  SEXP s_connection,
+  SEXP s_line_sep,
+  SEXP s_indent,
+  SEXP s_omap,
+  SEXP s_column_major,
+  SEXP s_unicode,
+  SEXP s_precision,
+  SEXP s_indent_mapping_sequence,
+  SEXP s_handlers,
+  SEXP s_flow_vectors,
+  SEXP s_anchors,
+  SEXP s_threads,
+  SEXP s_explicit_start)
+{
+  SEXP s_writer = NULL, s_prot = NULL;
+  s_yaml_writer *writer = NULL;
+  s_emitter_options options;
+  s_error_context error_ctx;
+  yaml_event_t event;
+
+  Ryaml_get_emitter_options(&options, s_line_sep, s_indent, s_omap,
+      s_column_major, s_unicode, s_precision, s_indent_mapping_sequence,
+      s_flow_vectors, s_anchors, s_threads);
+
+  if (!isLogical(s_explicit_start) || length(s_explicit_start) != 1) {
+    error("argument `explicit.start` must be either TRUE or FALSE");
+    return R_NilValue;
+  }
+
+  /* The cat() call and the handlers live as long as the writer does */
+  PROTECT(s_prot = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(s_prot, 0, Ryaml_connection_call(s_connection));
+  SET_VECTOR_ELT(s_prot, 1, Ryaml_sanitize_handlers(s_handlers));
+
+  writer = (s_yaml_writer *)calloc(1, sizeof(s_yaml_writer));
+  if (writer == NULL) {
+    UNPROTECT(1);
+    error("couldn't allocate memory for YAML writer");
+    return R_NilValue;
+  }
+  PROTECT(s_writer = R_MakeExternalPtr(writer, R_NilValue, s_prot));
+  R_RegisterCFinalizerEx(s_writer, Ryaml_finalize_writer, TRUE);
+
+  writer->options = options;
+  writer->explicit_start = LOGICAL(s_explicit_start)[0];
+  writer->output.s_call = VECTOR_ELT(s_prot, 0);
+  Ryaml_init_emitter(&writer->emitter, &writer->options, &writer->output);
+  writer->open = 1;
+
+  yaml_stream_start_event_initialize(&event, YAML_ANY_ENCODING);
+  if (!yaml_emitter_emit_hinted(&writer->emitter, &event, 0, NULL)) {
+    error_ctx.msg[0] = 0;
+    Ryaml_set_emitter_error(&writer->emitter, &error_ctx);
+    Ryaml_close_writer(writer);
+    UNPROTECT(2); /* s_prot, s_writer */
+    Ryaml_raise_error(&error_ctx, NULL);
+    return R_NilValue;
+  }
+
+  UNPROTECT(2); /* s_prot, s_writer */
+  return s_writer;
+}
+
+SEXP Ryaml_write_yaml_document(SEXP s_writer, SEXP s_obj)
+{
+  s_yaml_writer *writer = NULL;
+  SEXP s_handlers = NULL;
+  s_error_context error_ctx;
+  int status = 0;
+
+  writer = Ryaml_get_writer(s_writer);
+  s_handlers = VECTOR_ELT(R_ExternalPtrProtected(s_writer), 1);
+  error_ctx.msg[0] = 0;
+
+  /* Only the first document can leave out the "---" marker */
+  status = Ryaml_emit_document(&writer->emitter, &writer->options, s_handlers,
+      s_obj, !writer->explicit_start && writer->documents == 0,
+      &writer->output, NULL, &error_ctx);
+  writer->documents++;
+
+  if (!status) {
+    /* The emitter can't carry on after an error part way through a
+     * document */
+    Ryaml_set_emitter_error(&writer->emitter, &error_ctx);
+    Ryaml_close_writer(writer);
+    Ryaml_raise_error(&error_ctx, NULL);
+  }
+
+  return R_NilValue;
+}
+
+SEXP Ryaml_close_yaml_writer(SEXP s_writer)
+{
+  s_yaml_writer *writer = NULL;
+  s_error_context error_ctx;
+  yaml_event_t event;
+  int status = 0;
+
+  writer = Ryaml_get_writer(s_writer);
+
+  yaml_stream_end_event_initialize(&event);
+  status = yaml_emitter_emit_hinted(&writer->emitter, &event, 0, NULL);
+  if (!status) {
+    error_ctx.msg[0] = 0;
+    Ryaml_set_emitter_error(&writer->emitter, &error_ctx);
+  }
+  Ryaml_close_writer(writer);
+
+  if (!status) {
+    Ryaml_raise_error(&error_ctx, NULL);
+  }
+
+  return R_NilValue;
+}
@@ -8,28 +8,45 @@ SEXP Ryaml_FormatFunc = NULL;
 SEXP Ryaml_PasteFunc = NULL;
 SEXP Ryaml_DeparseFunc = NULL;
 SEXP Ryaml_ClassFunc = NULL;
+SEXP Ryaml_CatFunc = NULL;
 SEXP Ryaml_CollapseSymbol = NULL;
 SEXP Ryaml_Sentinel = NULL;
 SEXP Ryaml_SequenceStart = NULL;
 SEXP Ryaml_MappingStart = NULL;
 SEXP Ryaml_MappingEnd = NULL;
-char Ryaml_error_msg[ERROR_MSG_SIZE];
-
-void Ryaml_set_error_msg(const char *format, ...)
+SEXP Ryaml_TzoneSymbol = NULL;
+SEXP Ryaml_DateClass = NULL;
+SEXP Ryaml_POSIXctClass = NULL;
+SEXP Ryaml_UTCString = NULL;
+/* Doesn't call into R, so it's safe to use from worker threads */
+void Ryaml_set_error_msg(s_error_context *err, const char *format, ...)
 {
   va_list args;
   int result;
 
   va_start(args, format);
-  result = vsnprintf(Ryaml_error_msg, ERROR_MSG_SIZE, format, args);
+  result = vsnprintf(err->msg, ERROR_MSG_SIZE, format, args);
   va_end(args);
 
-  if (result >= ERROR_MSG_SIZE) {
+  err->truncated = result >= ERROR_MSG_SIZE;
+  if (err->truncated) {
+    /* ensure the string is null terminated */
+    err->msg[ERROR_MSG_SIZE-1] = 0;
+  }
+}
+
+/* Signal the error in err as an R error, with label prepended if it isn't
+ * NULL. Only call this from the main thread. */
+void Ryaml_raise_error(s_error_context *err, const char *label)
+{
+  if (err->truncated) {
     warning("an error occurred, but the message was too long to format properly");
+  }
 
-    /* ensure the string is null terminated */
-    Ryaml_error_msg[ERROR_MSG_SIZE-1] = 0;
+  if (label != NULL) {
+    error("(%s) %s", label, err->msg);
   }
+  error("%s", err->msg);
 }
 
 /* Returns true if obj is a named list */
@@ -219,8 +236,15 @@ int Ryaml_run_handler(SEXP s_handler, SEXP s_arg, SEXP *s_result)
 }
 
 R_CallMethodDef callMethods[] = {
-  {"unserialize_from_yaml", (DL_FUNC)&Ryaml_unserialize_from_yaml, 8},
-  {"serialize_to_yaml",     (DL_FUNC)&Ryaml_serialize_to_yaml,     9},
+  {"unserialize_from_yaml", (DL_FUNC)&Ryaml_unserialize_from_yaml, 15},
+  {"unserialize_from_yaml_files", (DL_FUNC)&Ryaml_unserialize_from_yaml_files, 13},
+  {"check_emitter_options", (DL_FUNC)&Ryaml_check_emitter_options, 10},
+  {"serialize_to_yaml",     (DL_FUNC)&Ryaml_serialize_to_yaml,     13},
+  {"open_yaml_writer",      (DL_FUNC)&Ryaml_open_yaml_writer,      13},
+  {"write_yaml_document",   (DL_FUNC)&Ryaml_write_yaml_document,   2},
+  {"close_yaml_writer",     (DL_FUNC)&Ryaml_close_yaml_writer,     1},
+  {"index_yaml",            (DL_FUNC)&Ryaml_index_yaml,            1},
+  {"hash_bytes",            (DL_FUNC)&Ryaml_hash_bytes,            1},
   {NULL, NULL, 0}
 };
 
@@ -234,10 +258,23 @@ void R_init_yaml(DllInfo *dll) {
   Ryaml_PasteFunc = findFun(install("paste"), R_GlobalEnv);
   Ryaml_DeparseFunc = findFun(install("deparse"), R_GlobalEnv);
   Ryaml_ClassFunc = findFun(install("class"), R_GlobalEnv);
+  Ryaml_CatFunc = findFun(install("cat"), R_GlobalEnv);
   Ryaml_Sentinel = install("sentinel");
   Ryaml_SequenceStart = install("sequence.start");
   Ryaml_MappingStart = install("mapping.start");
   Ryaml_MappingEnd = install("mapping.end");
+  Ryaml_TzoneSymbol = install("tzone");
+
+  /* Shared by every timestamp that the parser creates */
+  R_PreserveObject(Ryaml_DateClass = mkString("Date"));
+  MARK_NOT_MUTABLE(Ryaml_DateClass);
+  R_PreserveObject(Ryaml_POSIXctClass = allocVector(STRSXP, 2));
+  SET_STRING_ELT(Ryaml_POSIXctClass, 0, mkChar("POSIXct"));
+  SET_STRING_ELT(Ryaml_POSIXctClass, 1, mkChar("POSIXt"));
+  MARK_NOT_MUTABLE(Ryaml_POSIXctClass);
+  R_PreserveObject(Ryaml_UTCString = mkString("UTC"));
+  MARK_NOT_MUTABLE(Ryaml_UTCString);
+
   R_registerRoutines(dll, NULL, callMethods, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
   R_forceSymbols(dll, TRUE);
@@ -10,6 +10,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <float.h>
 #include "R.h"
 #include "Rdefines.h"
 #include "Rversion.h"
@@ -20,29 +22,103 @@
 #include "yaml.h"
 
 #define REAL_BUF_SIZE 256
+#define INT_BUF_SIZE 16
+#define PRECISION_SHORTEST 0
+#define BASE64_LINE_LENGTH 76
 #define ERROR_MSG_SIZE 512
+#define SCHEMA_YAML11 0
+#define SCHEMA_CORE 1
+#define SCHEMA_JSON 2
+#define SCHEMA_FAILSAFE 3
+
+/* Error state of one call to the loader or emitter. It is passed down to
+ * the functions doing the work instead of being global, so that stages
+ * that only use libyaml can run on several threads at once. */
+typedef struct {
+  char msg[ERROR_MSG_SIZE];
+  int truncated;
+} s_error_context;
 
 /* From implicit.c */
 char *Ryaml_find_implicit_tag(const char *value, size_t size);
 
+/* From r_schema.c */
+const char *Ryaml_find_schema_tag(const char *value, size_t len, int schema);
+
+/* From r_base64.c */
+size_t Ryaml_base64_encoded_size(size_t len);
+size_t Ryaml_base64_encode(const unsigned char *src, size_t len, char *dst);
+size_t Ryaml_base64_decoded_size(const char *src, size_t len);
+int Ryaml_base64_decode(const char *src, size_t len, unsigned char *dst, size_t *dst_len);
+
+/* From r_timestamp.c */
+int Ryaml_parse_timestamp(const char *value, size_t len, double *result, int *is_date);
+
+/* From r_number.c */
+int Ryaml_parse_int(const char *value, size_t len, int schema, int octal,
+    int *result, int *out_of_range);
+int Ryaml_parse_float(const char *value, size_t len, double *result);
+
+/* From r_json.c */
+typedef struct {
+  const char *pos;
+  const char *end;
+  const char *mark_pos;  /* where mark was last brought up to date */
+  yaml_mark_t mark;
+  char *stack;           /* '{' or '[' for each open collection */
+  size_t depth;
+  size_t stack_size;
+  int state;
+  int validate;          /* check the input without making events */
+  const char *problem;
+  yaml_mark_t problem_mark;
+} s_json_reader;
+
+void Ryaml_json_reader_initialize(s_json_reader *reader, const char *input, size_t len);
+void Ryaml_json_reader_delete(s_json_reader *reader);
+int Ryaml_json_reader_next(s_json_reader *reader, yaml_event_t *event);
+int Ryaml_is_json(const char *input, size_t len);
+
 /* Common functions */
 int Ryaml_is_named_list(SEXP s_obj);
 SEXP Ryaml_collapse(SEXP s_obj, char *collapse);
 SEXP Ryaml_inspect(SEXP s_obj);
 SEXP Ryaml_get_classes(SEXP s_obj);
 int Ryaml_has_class(SEXP s_obj, char *name);
-void Ryaml_set_error_msg(const char *format, ...);
+void Ryaml_set_error_msg(s_error_context *err, const char *format, ...);
+void Ryaml_raise_error(s_error_context *err, const char *label);
 SEXP Ryaml_sanitize_handlers(SEXP s_handlers);
 SEXP Ryaml_find_handler(SEXP s_handlers, const char *name);
 int Ryaml_run_handler(SEXP s_handler, SEXP s_arg, SEXP *s_result);
 
 /* Exported functions */
+SEXP Ryaml_check_emitter_options(SEXP s_line_sep, SEXP s_indent, SEXP s_omap,
+    SEXP s_column_major, SEXP s_unicode, SEXP s_precision,
+    SEXP s_indent_mapping_sequence, SEXP s_flow_vectors, SEXP s_anchors,
+    SEXP s_threads);
 SEXP Ryaml_serialize_to_yaml(SEXP s_obj, SEXP s_line_sep, SEXP s_indent, SEXP s_omap,
     SEXP s_column_major, SEXP s_unicode, SEXP s_precision,
-    SEXP s_indent_mapping_sequence, SEXP s_handlers);
+    SEXP s_indent_mapping_sequence, SEXP s_handlers, SEXP s_flow_vectors,
+    SEXP s_anchors, SEXP s_threads, SEXP s_connection);
+
+SEXP Ryaml_open_yaml_writer(SEXP s_connection, SEXP s_line_sep, SEXP s_indent,
+    SEXP s_omap, SEXP s_column_major, SEXP s_unicode, SEXP s_precision,
+    SEXP s_indent_mapping_sequence, SEXP s_handlers, SEXP s_flow_vectors,
+    SEXP s_anchors, SEXP s_threads, SEXP s_explicit_start);
+SEXP Ryaml_write_yaml_document(SEXP s_writer, SEXP s_obj);
+SEXP Ryaml_close_yaml_writer(SEXP s_writer);
 
 SEXP Ryaml_unserialize_from_yaml(SEXP s_string, SEXP s_as_named_list,
     SEXP s_handlers, SEXP s_error_label, SEXP s_eval_expr,
-    SEXP s_eval_warning, SEXP s_merge_precedence, SEXP s_merge_warning);
+    SEXP s_eval_warning, SEXP s_merge_precedence, SEXP s_merge_warning,
+    SEXP s_timestamps, SEXP s_simplify, SEXP s_limits, SEXP s_threads,
+    SEXP s_schema, SEXP s_prototype, SEXP s_json);
+SEXP Ryaml_unserialize_from_yaml_files(SEXP s_files, SEXP s_threads,
+    SEXP s_as_named_list, SEXP s_handlers, SEXP s_eval_expr,
+    SEXP s_eval_warning, SEXP s_merge_precedence, SEXP s_merge_warning,
+    SEXP s_timestamps, SEXP s_simplify, SEXP s_limits, SEXP s_schema,
+    SEXP s_prototype);
+SEXP Ryaml_index_yaml(SEXP s_file);
+SEXP Ryaml_hash_bytes(SEXP s_bytes);
 
 #endif
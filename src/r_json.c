@@ -0,0 +1,621 @@
+#include "r_ext.h"
+
+/* A reader for documents that are plain JSON (https://www.json.org). It
+ * gives the same events libyaml does for them, without the bookkeeping for
+ * block context (indentation, simple keys and the token queue) that libyaml
+ * does for every document. The few JSON texts that libyaml reads
+ * differently or rejects are rejected here too: tabs outside of
+ * collections, keys that are longer than 1024 characters or separated from
+ * their colon by a line break, escaped surrogates, and characters YAML
+ * doesn't allow or takes as line breaks. It only uses the C library, so
+ * that it doesn't call into R. */
+
+enum {
+  JSON_STREAM_START,
+  JSON_DOCUMENT_START,
+  JSON_VALUE,
+  JSON_FIRST_ITEM,
+  JSON_FIRST_KEY,
+  JSON_KEY,
+  JSON_AFTER_VALUE,
+  JSON_DOCUMENT_END,
+  JSON_STREAM_END,
+  JSON_DONE
+};
+
+#define JSON_STACK_INITIAL_SIZE 64
+#define JSON_MAX_KEY_LENGTH 1024
+
+/* Brings reader->mark up to reader->pos. Marks count characters, not
+ * bytes, like libyaml's do. */
+static yaml_mark_t Ryaml_json_mark(s_json_reader *reader)
+{
+  const unsigned char *str = (const unsigned char *)reader->mark_pos,
+                      *end = (const unsigned char *)reader->pos;
+
+  for (; str < end; str++) {
+    if (*str == '\n' || (*str == '\r' && (str + 1 == end || str[1] != '\n'))) {
+      reader->mark.line++;
+      reader->mark.column = 0;
+      reader->mark.index++;
+    }
+    else if ((*str & 0xC0) != 0x80) {
+      reader->mark.column++;
+      reader->mark.index++;
+    }
+  }
+  reader->mark_pos = reader->pos;
+
+  return reader->mark;
+}
+
+static int Ryaml_json_problem(s_json_reader *reader, const char *problem)
+{
+  reader->problem = problem;
+  reader->problem_mark = Ryaml_json_mark(reader);
+
+  return 0;
+}
+
+/* Skips whitespace. YAML only allows tabs as whitespace inside of flow
+ * collections. */
+static int Ryaml_json_skip_space(s_json_reader *reader)
+{
+  const char *str = reader->pos, *end = reader->end;
+
+  while (str < end && (*str == ' ' || *str == '\n' || *str == '\r' || *str == '\t')) {
+    if (*str == '\t' && reader->depth == 0) {
+      reader->pos = str;
+      return Ryaml_json_problem(reader, "found a tab outside of a collection");
+    }
+    str++;
+  }
+  reader->pos = str;
+
+  return 1;
+}
+
+/* Length of the UTF-8 character at str, or 0 if it is malformed or isn't
+ * a printable character as YAML defines them. YAML's other line breaks
+ * (NEL, LS and PS) are left out too, since libyaml folds them in quoted
+ * scalars. */
+static size_t Ryaml_json_utf8_length(const unsigned char *str, const unsigned char *end)
+{
+  unsigned int value = 0;
+  size_t len = 0, i = 0;
+
+  if ((str[0] & 0xE0) == 0xC0) {
+    len = 2;
+    value = str[0] & 0x1F;
+  }
+  else if ((str[0] & 0xF0) == 0xE0) {
+    len = 3;
+    value = str[0] & 0x0F;
+  }
+  else if ((str[0] & 0xF8) == 0xF0) {
+    len = 4;
+    value = str[0] & 0x07;
+  }
+  else {
+    return 0;
+  }
+  if ((size_t)(end - str) < len) {
+    return 0;
+  }
+  for (i = 1; i < len; i++) {
+    if ((str[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+    value = (value << 6) | (str[i] & 0x3F);
+  }
+
+  if ((len == 2 && value < 0x80) || (len == 3 && value < 0x800) || (len == 4 && value < 0x10000)) {
+    return 0;
+  }
+  if (!((value >= 0xA0 && value <= 0xD7FF && value != 0x2028 && value != 0x2029) ||
+        (value >= 0xE000 && value <= 0xFFFD) || (value >= 0x10000 && value <= 0x10FFFF))) {
+    return 0;
+  }
+
+  return len;
+}
+
+static int Ryaml_json_hex_value(const char *str)
+{
+  int value = 0, i = 0;
+  char c = 0;
+
+  for (i = 0; i < 4; i++) {
+    c = str[i];
+    if (c >= '0' && c <= '9') {
+      value = value * 16 + c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+      value = value * 16 + c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F') {
+      value = value * 16 + c - 'A' + 10;
+    }
+    else {
+      return -1;
+    }
+  }
+
+  return value;
+}
+
+/* Length of the escape sequence at str, or 0 if it isn't a valid one */
+static size_t Ryaml_json_escape_length(const char *str, const char *end)
+{
+  int value = 0;
+
+  if (end - str < 2) {
+    return 0;
+  }
+  switch (str[1]) {
+    case '"':
+    case '\\':
+    case '/':
+    case 'b':
+    case 'f':
+    case 'n':
+    case 'r':
+    case 't':
+      return 2;
+    case 'u':
+      if (end - str < 6 || (value = Ryaml_json_hex_value(str + 2)) < 0 ||
+          (value >= 0xD800 && value <= 0xDFFF)) {
+        return 0;
+      }
+      return 6;
+  }
+
+  return 0;
+}
+
+/* Copies the string between str and end to value, replacing escape
+ * sequences, which have already been checked */
+static size_t Ryaml_json_unescape(const char *str, const char *end, char *value)
+{
+  char *out = value;
+  int code = 0;
+
+  while (str < end) {
+    if (*str != '\\') {
+      *(out++) = *(str++);
+      continue;
+    }
+    switch (str[1]) {
+      case 'b':
+        *(out++) = '\b';
+        break;
+      case 'f':
+        *(out++) = '\f';
+        break;
+      case 'n':
+        *(out++) = '\n';
+        break;
+      case 'r':
+        *(out++) = '\r';
+        break;
+      case 't':
+        *(out++) = '\t';
+        break;
+      case 'u':
+        code = Ryaml_json_hex_value(str + 2);
+        if (code < 0x80) {
+          *(out++) = (char)code;
+        }
+        else if (code < 0x800) {
+          *(out++) = (char)(0xC0 | (code >> 6));
+          *(out++) = (char)(0x80 | (code & 0x3F));
+        }
+        else {
+          *(out++) = (char)(0xE0 | (code >> 12));
+          *(out++) = (char)(0x80 | ((code >> 6) & 0x3F));
+          *(out++) = (char)(0x80 | (code & 0x3F));
+        }
+        str += 4;
+        break;
+      default:
+        *(out++) = str[1];
+        break;
+    }
+    str += 2;
+  }
+  *out = 0;
+
+  return out - value;
+}
+
+/* Reads the string that starts at reader->pos. Unless the reader only
+ * validates, the string is unescaped into a new buffer, which the event
+ * owns. */
+static int Ryaml_json_read_string(s_json_reader *reader, yaml_event_t *event)
+{
+  const char *start = reader->pos + 1, *str = start, *end = reader->end;
+  unsigned char c = 0;
+  size_t len = 0;
+  int escaped = 0;
+  char *value = NULL;
+
+  for (;;) {
+    if (str == end) {
+      return Ryaml_json_problem(reader, "found an unterminated string");
+    }
+    c = (unsigned char)*str;
+    if (c == '"') {
+      break;
+    }
+    if (c == '\\') {
+      len = Ryaml_json_escape_length(str, end);
+      escaped = 1;
+    }
+    else if (c >= 0x80) {
+      len = Ryaml_json_utf8_length((const unsigned char *)str, (const unsigned char *)end);
+    }
+    else {
+      len = c >= 0x20 && c != 0x7F;
+    }
+    if (len == 0) {
+      reader->pos = str;
+      return Ryaml_json_problem(reader, "found an invalid character or escape in a string");
+    }
+    str += len;
+  }
+
+  if (!reader->validate) {
+    value = (char *)malloc(str - start + 1);
+    if (value == NULL) {
+      return Ryaml_json_problem(reader, "not enough memory for parsing");
+    }
+    if (escaped) {
+      len = Ryaml_json_unescape(start, str, value);
+    }
+    else {
+      len = str - start;
+      memcpy(value, start, len);
+      value[len] = 0;
+    }
+    event->data.scalar.value = (yaml_char_t *)value;
+    event->data.scalar.length = len;
+  }
+  event->type = YAML_SCALAR_EVENT;
+  event->data.scalar.quoted_implicit = 1;
+  event->data.scalar.style = YAML_DOUBLE_QUOTED_SCALAR_STYLE;
+  reader->pos = str + 1;
+
+  return 1;
+}
+
+static int Ryaml_json_is_number(const char *str, const char *end)
+{
+  if (str < end && *str == '-') {
+    str++;
+  }
+  if (str < end && *str == '0') {
+    str++;
+  }
+  else if (str < end && *str >= '1' && *str <= '9') {
+    while (str < end && *str >= '0' && *str <= '9') {
+      str++;
+    }
+  }
+  else {
+    return 0;
+  }
+
+  if (str < end && *str == '.') {
+    str++;
+    if (str == end || *str < '0' || *str > '9') {
+      return 0;
+    }
+    while (str < end && *str >= '0' && *str <= '9') {
+      str++;
+    }
+  }
+  if (str < end && (*str == 'e' || *str == 'E')) {
+    str++;
+    if (str < end && (*str == '-' || *str == '+')) {
+      str++;
+    }
+    if (str == end || *str < '0' || *str > '9') {
+      return 0;
+    }
+    while (str < end && *str >= '0' && *str <= '9') {
+      str++;
+    }
+  }
+
+  return str == end;
+}
+
+static int Ryaml_json_ends_literal(char c)
+{
+  switch (c) {
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+    case ',':
+    case ']':
+    case '}':
+    case ':':
+      return 1;
+  }
+  return 0;
+}
+
+/* Reads a number, true, false or null, which are plain scalars in YAML */
+static int Ryaml_json_read_literal(s_json_reader *reader, yaml_event_t *event)
+{
+  const char *start = reader->pos, *str = start, *end = reader->end;
+  char *value = NULL;
+  size_t len = 0;
+
+  while (str < end && !Ryaml_json_ends_literal(*str)) {
+    str++;
+  }
+  len = str - start;
+  if (len == 0 ||
+      !((len == 4 && memcmp(start, "true", 4) == 0) ||
+        (len == 5 && memcmp(start, "false", 5) == 0) ||
+        (len == 4 && memcmp(start, "null", 4) == 0) ||
+        Ryaml_json_is_number(start, str))) {
+    return Ryaml_json_problem(reader, "found an unexpected value");
+  }
+
+  if (!reader->validate) {
+    value = (char *)malloc(len + 1);
+    if (value == NULL) {
+      return Ryaml_json_problem(reader, "not enough memory for parsing");
+    }
+    memcpy(value, start, len);
+    value[len] = 0;
+    event->data.scalar.value = (yaml_char_t *)value;
+    event->data.scalar.length = len;
+  }
+  event->type = YAML_SCALAR_EVENT;
+  event->data.scalar.plain_implicit = 1;
+  event->data.scalar.style = YAML_PLAIN_SCALAR_STYLE;
+  reader->pos = str;
+
+  return 1;
+}
+
+/* Reads a key and the colon after it */
+static int Ryaml_json_read_key(s_json_reader *reader, yaml_event_t *event)
+{
+  yaml_mark_t key_mark, colon_mark;
+
+  if (reader->pos == reader->end || *reader->pos != '"') {
+    return Ryaml_json_problem(reader, "did not find the expected key");
+  }
+  key_mark = Ryaml_json_mark(reader);
+  if (!Ryaml_json_read_string(reader, event) || !Ryaml_json_skip_space(reader)) {
+    return 0;
+  }
+  if (reader->pos == reader->end || *reader->pos != ':') {
+    return Ryaml_json_problem(reader, "did not find the expected ':'");
+  }
+
+  /* Otherwise libyaml wouldn't take the string as a key */
+  colon_mark = Ryaml_json_mark(reader);
+  if (colon_mark.line != key_mark.line || colon_mark.index > key_mark.index + JSON_MAX_KEY_LENGTH) {
+    reader->problem = "found a key longer than 1024 characters or on another line than its ':'";
+    reader->problem_mark = key_mark;
+    return 0;
+  }
+  reader->pos++;
+
+  return 1;
+}
+
+static int Ryaml_json_push(s_json_reader *reader, char c)
+{
+  char *stack = NULL;
+
+  if (reader->depth == reader->stack_size) {
+    stack = (char *)realloc(reader->stack, reader->stack_size == 0 ?
+        JSON_STACK_INITIAL_SIZE : reader->stack_size * 2);
+    if (stack == NULL) {
+      return Ryaml_json_problem(reader, "not enough memory for parsing");
+    }
+    reader->stack = stack;
+    reader->stack_size = reader->stack_size == 0 ? JSON_STACK_INITIAL_SIZE : reader->stack_size * 2;
+  }
+  reader->stack[reader->depth++] = c;
+
+  return 1;
+}
+
+static int Ryaml_json_read_value(s_json_reader *reader, yaml_event_t *event)
+{
+  if (reader->pos == reader->end) {
+    return Ryaml_json_problem(reader, "did not find the expected value");
+  }
+
+  switch (*reader->pos) {
+    case '{':
+      if (!Ryaml_json_push(reader, '{')) {
+        return 0;
+      }
+      event->type = YAML_MAPPING_START_EVENT;
+      event->data.mapping_start.implicit = 1;
+      event->data.mapping_start.style = YAML_FLOW_MAPPING_STYLE;
+      reader->pos++;
+      reader->state = JSON_FIRST_KEY;
+      return 1;
+
+    case '[':
+      if (!Ryaml_json_push(reader, '[')) {
+        return 0;
+      }
+      event->type = YAML_SEQUENCE_START_EVENT;
+      event->data.sequence_start.implicit = 1;
+      event->data.sequence_start.style = YAML_FLOW_SEQUENCE_STYLE;
+      reader->pos++;
+      reader->state = JSON_FIRST_ITEM;
+      return 1;
+
+    case '"':
+      reader->state = JSON_AFTER_VALUE;
+      return Ryaml_json_read_string(reader, event);
+
+    default:
+      reader->state = JSON_AFTER_VALUE;
+      return Ryaml_json_read_literal(reader, event);
+  }
+}
+
+void Ryaml_json_reader_initialize(s_json_reader *reader, const char *input, size_t len)
+{
+  memset(reader, 0, sizeof(s_json_reader));
+  reader->pos = reader->mark_pos = input;
+  reader->end = input + len;
+  if (len >= 3 && memcmp(input, "\xEF\xBB\xBF", 3) == 0) {
+    reader->pos = reader->mark_pos = input + 3;
+  }
+  reader->state = JSON_STREAM_START;
+}
+
+void Ryaml_json_reader_delete(s_json_reader *reader)
+{
+  free(reader->stack);
+  memset(reader, 0, sizeof(s_json_reader));
+}
+
+/* Gets the next event, which the caller deletes with yaml_event_delete.
+ * Returns 0 with reader->problem set if the input isn't JSON. */
+int Ryaml_json_reader_next(s_json_reader *reader, yaml_event_t *event)
+{
+  yaml_mark_t mark;
+  int ok = 1;
+
+  memset(event, 0, sizeof(yaml_event_t));
+  for (;;) {
+    if (reader->state != JSON_STREAM_START && reader->state != JSON_AFTER_VALUE &&
+        !Ryaml_json_skip_space(reader)) {
+      return 0;
+    }
+    mark = Ryaml_json_mark(reader);
+    if (reader->pos == reader->end && mark.column > 0) {
+      /* libyaml ends the last line if the input doesn't */
+      mark.line++;
+      mark.column = 0;
+    }
+
+    switch (reader->state) {
+      case JSON_STREAM_START:
+        event->type = YAML_STREAM_START_EVENT;
+        event->data.stream_start.encoding = YAML_UTF8_ENCODING;
+        reader->state = JSON_DOCUMENT_START;
+        break;
+
+      case JSON_DOCUMENT_START:
+        if (reader->pos == reader->end) {
+          event->type = YAML_STREAM_END_EVENT;
+          reader->state = JSON_DONE;
+        }
+        else {
+          event->type = YAML_DOCUMENT_START_EVENT;
+          event->data.document_start.implicit = 1;
+          reader->state = JSON_VALUE;
+        }
+        break;
+
+      case JSON_FIRST_ITEM:
+      case JSON_FIRST_KEY:
+        if (reader->pos < reader->end && *reader->pos == (reader->state == JSON_FIRST_KEY ? '}' : ']')) {
+          event->type = reader->state == JSON_FIRST_KEY ? YAML_MAPPING_END_EVENT : YAML_SEQUENCE_END_EVENT;
+          reader->pos++;
+          reader->depth--;
+          reader->state = JSON_AFTER_VALUE;
+          break;
+        }
+        reader->state = reader->state == JSON_FIRST_KEY ? JSON_KEY : JSON_VALUE;
+        continue;
+
+      case JSON_KEY:
+        ok = Ryaml_json_read_key(reader, event);
+        reader->state = JSON_VALUE;
+        break;
+
+      case JSON_VALUE:
+        ok = Ryaml_json_read_value(reader, event);
+        break;
+
+      case JSON_AFTER_VALUE:
+        if (reader->depth == 0) {
+          reader->state = JSON_DOCUMENT_END;
+          continue;
+        }
+        if (!Ryaml_json_skip_space(reader)) {
+          return 0;
+        }
+        mark = Ryaml_json_mark(reader);
+        if (reader->pos < reader->end && *reader->pos == ',') {
+          reader->pos++;
+          reader->state = reader->stack[reader->depth - 1] == '{' ? JSON_KEY : JSON_VALUE;
+          continue;
+        }
+        if (reader->pos < reader->end && *reader->pos == (reader->stack[reader->depth - 1] == '{' ? '}' : ']')) {
+          event->type = *reader->pos == '}' ? YAML_MAPPING_END_EVENT : YAML_SEQUENCE_END_EVENT;
+          reader->pos++;
+          reader->depth--;
+          break;
+        }
+        return Ryaml_json_problem(reader, reader->stack[reader->depth - 1] == '{' ?
+            "did not find the expected ',' or '}'" : "did not find the expected ',' or ']'");
+
+      case JSON_DOCUMENT_END:
+        if (reader->pos != reader->end) {
+          return Ryaml_json_problem(reader, "found content after the end of the document");
+        }
+        event->type = YAML_DOCUMENT_END_EVENT;
+        event->data.document_end.implicit = 1;
+        reader->state = JSON_STREAM_END;
+        break;
+
+      default:
+        event->type = YAML_STREAM_END_EVENT;
+        reader->state = JSON_DONE;
+        break;
+    }
+
+    if (!ok) {
+      yaml_event_delete(event);
+      return 0;
+    }
+    event->start_mark = mark;
+    event->end_mark = Ryaml_json_mark(reader);
+    return 1;
+  }
+}
+
+/* Whether input is a JSON object or array that the reader gives the same
+ * events for as libyaml. Only checks, without keeping anything. */
+int Ryaml_is_json(const char *input, size_t len)
+{
+  s_json_reader reader;
+  yaml_event_t event;
+  int result = 0;
+
+  Ryaml_json_reader_initialize(&reader, input, len);
+  if (!Ryaml_json_skip_space(&reader) || reader.pos == reader.end ||
+      (*reader.pos != '{' && *reader.pos != '[')) {
+    Ryaml_json_reader_delete(&reader);
+    return 0;
+  }
+
+  reader.validate = 1;
+  while (Ryaml_json_reader_next(&reader, &event)) {
+    if (event.type == YAML_STREAM_END_EVENT) {
+      result = 1;
+      break;
+    }
+  }
+  Ryaml_json_reader_delete(&reader);
+
+  return result;
+}
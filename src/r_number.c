@@ -0,0 +1,238 @@
+#include "r_ext.h"
+
+/* Conversion of int and float scalars in a single pass over their bytes,
+ * instead of going through strtol and checking the end pointer. Values
+ * that need more than a simple decimal conversion are left to strtod. */
+
+/* Largest integer and power of ten that a double holds exactly */
+#define MAX_EXACT_MANTISSA 9007199254740992.0
+#define MAX_EXACT_POW10 22
+
+static const double Ryaml_pow10[MAX_EXACT_POW10 + 1] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int Ryaml_digit_value(char c, int base)
+{
+  int d = 0;
+
+  if (c >= '0' && c <= '9') {
+    d = c - '0';
+  }
+  else if (c >= 'a' && c <= 'f') {
+    d = c - 'a' + 10;
+  }
+  else if (c >= 'A' && c <= 'F') {
+    d = c - 'A' + 10;
+  }
+  else {
+    return -1;
+  }
+
+  return d < base ? d : -1;
+}
+
+/* Accumulates the digits of str in the given base, stopping at the first
+ * other character. Returns the number of digits read. */
+static size_t Ryaml_accumulate_digits(
+  const char *str,
+  const char *end,
+  int base,
+  double *result)
+{
+  const char *start = str;
+  double n = 0;
+  int d = 0;
+
+  while (str < end && (d = Ryaml_digit_value(*str, base)) >= 0) {
+    n = n * base + d;
+    str++;
+  }
+  *result = n;
+
+  return str - start;
+}
+
+/* Sexagesimal values, e.g. 1:30:20 (http://yaml.org/type/int.html). Each
+ * part after the first is between 0 and 59. The last part of a float may
+ * have a fraction, which is converted by Ryaml_parse_float. */
+static int Ryaml_parse_base60(
+  const char *str,
+  const char *end,
+  int is_float,
+  double *result)
+{
+  const char *colon = NULL;
+  double n = 0, part = 0;
+  size_t digits = 0;
+  int first = 1;
+
+  for (;;) {
+    colon = memchr(str, ':', end - str);
+    if (colon == NULL) {
+      break;
+    }
+    digits = Ryaml_accumulate_digits(str, colon, 10, &part);
+    if (digits == 0 || str + digits != colon || (!first && part >= 60)) {
+      return 0;
+    }
+    n = n * 60 + part;
+    str = colon + 1;
+    first = 0;
+  }
+
+  if (is_float) {
+    if (str == end || *str < '0' || *str > '9' ||
+        !Ryaml_parse_float(str, end - str, &part) || part >= 60) {
+      return 0;
+    }
+  }
+  else {
+    digits = Ryaml_accumulate_digits(str, end, 10, &part);
+    if (digits == 0 || str + digits != end || part >= 60) {
+      return 0;
+    }
+  }
+  *result = n * 60 + part;
+
+  return 1;
+}
+
+/* Converts a decimal, hexadecimal (0x), octal or sexagesimal integer with
+ * an optional sign. Octal integers start with 0 in YAML 1.1 and with 0o in
+ * the YAML 1.2 schemas, which have no sexagesimal integers. If octal is 0,
+ * a YAML 1.1 integer with a leading 0 is read as decimal, which is how an
+ * explicit !!int has always been read. Returns 0 if value isn't an
+ * integer, and sets *out_of_range if it is one but doesn't fit in an R
+ * integer. */
+int Ryaml_parse_int(
+  const char *value,
+  size_t len,
+  int schema,
+  int octal,
+  int *result,
+  int *out_of_range)
+{
+  const char *str = value, *end = value + len;
+  double n = 0;
+  size_t digits = 0;
+  int negative = 0;
+
+  *out_of_range = 0;
+  if (str < end && (*str == '-' || *str == '+')) {
+    negative = *str == '-';
+    str++;
+  }
+  if (str == end) {
+    return 0;
+  }
+
+  if (schema == SCHEMA_YAML11 && memchr(str, ':', end - str) != NULL) {
+    if (!Ryaml_parse_base60(str, end, 0, &n)) {
+      return 0;
+    }
+  }
+  else {
+    if (end - str > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+      str += 2;
+      digits = Ryaml_accumulate_digits(str, end, 16, &n);
+    }
+    else if (schema != SCHEMA_YAML11 && end - str > 2 && str[0] == '0' && str[1] == 'o') {
+      str += 2;
+      digits = Ryaml_accumulate_digits(str, end, 8, &n);
+    }
+    else if (schema == SCHEMA_YAML11 && octal && end - str > 1 && str[0] == '0') {
+      digits = Ryaml_accumulate_digits(str, end, 8, &n);
+    }
+    else {
+      digits = Ryaml_accumulate_digits(str, end, 10, &n);
+    }
+    if (digits == 0 || str + digits != end) {
+      return 0;
+    }
+  }
+
+  /* INT_MIN is NA_INTEGER in R, so it's out of range as well */
+  if (n > INT_MAX) {
+    *out_of_range = 1;
+    return 1;
+  }
+  *result = negative ? -(int)n : (int)n;
+
+  return 1;
+}
+
+/* Converts a float with an optional sign. Decimals with at most 15
+ * significant digits and small exponents are exact in a double, and are
+ * converted with a single multiplication or division, which rounds the
+ * same as strtod. Everything else goes through strtod. Returns 0 if value
+ * isn't a float, or sets *result to NA_REAL if it is out of range. */
+int Ryaml_parse_float(const char *value, size_t len, double *result)
+{
+  const char *str = value, *end = value + len;
+  char *endptr = NULL;
+  double mantissa = 0, exponent = 0, f = 0;
+  size_t int_digits = 0, frac_digits = 0, exp_digits = 0;
+  int negative = 0, exp_negative = 0, scale = 0;
+
+  if (str < end && (*str == '-' || *str == '+')) {
+    negative = *str == '-';
+    str++;
+  }
+
+  if (memchr(str, ':', end - str) != NULL) {
+    if (!Ryaml_parse_base60(str, end, 1, &f)) {
+      return 0;
+    }
+    *result = negative ? -f : f;
+    return 1;
+  }
+
+  int_digits = Ryaml_accumulate_digits(str, end, 10, &mantissa);
+  str += int_digits;
+  if (str < end && *str == '.') {
+    str++;
+    while (str < end && *str >= '0' && *str <= '9') {
+      mantissa = mantissa * 10 + (*str - '0');
+      frac_digits++;
+      str++;
+    }
+  }
+  if (int_digits + frac_digits > 0 && str < end && (*str == 'e' || *str == 'E')) {
+    str++;
+    if (str < end && (*str == '-' || *str == '+')) {
+      exp_negative = *str == '-';
+      str++;
+    }
+    exp_digits = Ryaml_accumulate_digits(str, end, 10, &exponent);
+    str += exp_digits;
+    if (exp_digits == 0) {
+      str = value;
+    }
+  }
+
+  if (str == end && int_digits + frac_digits > 0 && int_digits + frac_digits <= 15 &&
+      mantissa < MAX_EXACT_MANTISSA && exponent <= MAX_EXACT_POW10) {
+    scale = (exp_negative ? -(int)exponent : (int)exponent) - (int)frac_digits;
+    if (scale >= -MAX_EXACT_POW10 && scale <= MAX_EXACT_POW10) {
+      f = scale < 0 ? mantissa / Ryaml_pow10[-scale] : mantissa * Ryaml_pow10[scale];
+      *result = negative ? -f : f;
+      return 1;
+    }
+  }
+
+  /* The value is NUL-terminated, as all libyaml scalars are */
+  errno = 0;
+  f = strtod(value, &endptr);
+  if (endptr != value + len || endptr == value) {
+    return 0;
+  }
+  /* Subnormal results set ERANGE too, but are exact enough to keep */
+  if ((errno == ERANGE && (f == 0 || !R_FINITE(f))) || ISNA(f)) {
+    f = NA_REAL;
+  }
+  *result = f;
+
+  return 1;
+}
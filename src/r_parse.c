@@ -6,7 +6,19 @@ extern SEXP Ryaml_Sentinel;
 extern SEXP Ryaml_SequenceStart;
 extern SEXP Ryaml_MappingStart;
 extern SEXP Ryaml_MappingEnd;
-extern char Ryaml_error_msg[ERROR_MSG_SIZE];
+extern SEXP Ryaml_TzoneSymbol;
+extern SEXP Ryaml_DateClass;
+extern SEXP Ryaml_POSIXctClass;
+extern SEXP Ryaml_UTCString;
+
+/* Bounds on the work done for one document. -1 means no limit. */
+typedef struct {
+  long depth;        /* nested sequences and maps */
+  long nodes;        /* scalars, aliases, sequences and maps */
+  long scalar_size;  /* bytes in one scalar */
+  long merge_keys;   /* keys copied or skipped by merges, in total */
+  long merge_keys_used;
+} s_load_limits;
 
 /* Compare two R objects (with the R identical function).
  * Returns 0 or 1 */
@@ -84,6 +96,24 @@ static void Ryaml_set_class(SEXP s_obj, char *name)
   Ryaml_set_str_attrib(s_obj, R_ClassSymbol, name);
 }
 
+/* Pseudo types (not SEXPTYPEs) that handle_sequence uses for timestamps, so
+ * that a sequence of them can be packed into a single Date or POSIXct
+ * vector */
+#define DATE_TYPE    1001
+#define POSIXCT_TYPE 1002
+
+/* Make a numeric vector into a Date (days) or a UTC POSIXct (seconds) */
+static void Ryaml_set_timestamp_class(SEXP s_obj, int is_date)
+{
+  if (is_date) {
+    setAttrib(s_obj, R_ClassSymbol, Ryaml_DateClass);
+  }
+  else {
+    setAttrib(s_obj, R_ClassSymbol, Ryaml_POSIXctClass);
+    setAttrib(s_obj, Ryaml_TzoneSymbol, Ryaml_UTCString);
+  }
+}
+
 /* Get the type part of the tag, throw away any !'s */
 static const char *process_tag(const char *tag)
 {
@@ -100,34 +130,36 @@ static const char *process_tag(const char *tag)
   return retval;
 }
 
+/* Find the object with the alias event's anchor, or NULL */
+static SEXP find_alias(yaml_event_t *event, SEXP s_aliases_head)
+{
+  SEXP s_curr = NULL;
+  const char *anchor = (const char *)event->data.alias.anchor;
+
+  for (s_curr = CDR(s_aliases_head); s_curr != R_NilValue; s_curr = CDR(s_curr)) {
+    if (strcmp(CHAR(TAG(s_curr)), anchor) == 0) {
+      return CAR(s_curr);
+    }
+  }
+
+  return NULL;
+}
+
 static int handle_alias(
   yaml_event_t *event,
   SEXP *s_stack_tail,
   SEXP s_aliases_head)
 {
-  SEXP s_curr = NULL, s_obj = NULL;
-  int handled = 0;
-  const char *name = NULL, *anchor = NULL;
+  SEXP s_obj = NULL;
 
-  /* Try to find object with the supplied anchor */
-  anchor = (const char *)event->data.alias.anchor;
-  s_curr = CDR(s_aliases_head);
-  while (s_curr != R_NilValue) {
-    s_obj = CAR(s_curr);
-    name = CHAR(TAG(s_curr));
-    if (strcmp(name, anchor) == 0) {
-      /* Found object, push onto stack */
-      SETCDR(*s_stack_tail, list1(s_obj));
-      *s_stack_tail = CDR(*s_stack_tail);
-
-      MARK_NOT_MUTABLE(s_obj);
-      handled = 1;
-      break;
-    }
-    s_curr = CDR(s_curr);
+  s_obj = find_alias(event, s_aliases_head);
+  if (s_obj != NULL) {
+    /* Found object, push onto stack */
+    SETCDR(*s_stack_tail, list1(s_obj));
+    *s_stack_tail = CDR(*s_stack_tail);
+    MARK_NOT_MUTABLE(s_obj);
   }
-
-  if (!handled) {
+  else {
     warning("Unknown anchor: %s", (char *)event->data.alias.anchor);
     PROTECT(s_obj = ScalarString(mkCharCE("_yaml.bad-anchor_", CE_UTF8)));
     Ryaml_set_class(s_obj, "_yaml.bad-anchor_");
@@ -145,14 +177,15 @@ static int handle_scalar(
   SEXP *s_stack_tail,
   SEXP s_handlers,
   int eval_expr,
-  int eval_warning)
+  int eval_warning,
+  int timestamps,
+  int schema,
+  s_error_context *error_ctx)
 {
   SEXP s_obj = NULL, s_handler = NULL, s_new_obj = NULL, s_expr = NULL;
-  const char *value = NULL, *tag = NULL, *nptr = NULL;
-  char *endptr = NULL;
-  size_t len = 0;
-  int handled = 0, coercion_err = 0, base = 0, n = 0;
-  long int long_n = 0;
+  const char *value = NULL, *tag = NULL;
+  size_t len = 0, raw_len = 0;
+  int handled = 0, coercion_err = 0, n = 0, out_of_range = 0, is_date = 0;
   double f = 0.0f;
   ParseStatus parse_status;
 
@@ -170,7 +203,7 @@ static int handle_scalar(
         break;
       default:
         /* Try to tag it */
-        tag = Ryaml_find_implicit_tag(value, len);
+        tag = Ryaml_find_schema_tag(value, len, schema);
     }
   }
   else {
@@ -181,18 +214,54 @@ static int handle_scalar(
   Rprintf("Value: (%s), Tag: (%s)\n", value, tag);
 #endif
 
-  /* 'Vanilla' object */
-  PROTECT(s_obj = ScalarString(mkCharCE(value, CE_UTF8)));
+  /* Decode binary data straight into a raw vector, without making a string
+   * first, unless a custom handler wants the string */
+  if (strcmp(tag, "binary") == 0 && Ryaml_find_handler(s_handlers, tag) == R_NilValue) {
+    PROTECT(s_new_obj = allocVector(RAWSXP, Ryaml_base64_decoded_size(value, len)));
+    if (!Ryaml_base64_decode(value, len, RAW(s_new_obj), &raw_len)) {
+      UNPROTECT(1); /* s_new_obj */
+      Ryaml_set_error_msg(error_ctx, "Invalid base64 data for binary scalar");
+      return 1;
+    }
+    SETCDR(*s_stack_tail, list1(s_new_obj));
+    *s_stack_tail = CDR(*s_stack_tail);
+    UNPROTECT(1); /* s_new_obj */
 
-  /* Look for a custom R handler */
+    return 0;
+  }
+
+  /* Likewise, convert timestamps straight into a Date or POSIXct when asked
+   * to. Times without a time zone are in UTC. */
+  if (timestamps && (strcmp(tag, "timestamp") == 0 || strncmp(tag, "timestamp#", 10) == 0) &&
+      Ryaml_find_handler(s_handlers, tag) == R_NilValue) {
+    if (!Ryaml_parse_timestamp(value, len, &f, &is_date)) {
+      warning("NAs introduced by coercion: %s is not a valid timestamp", value);
+      f = NA_REAL;
+      is_date = strcmp(tag, "timestamp#ymd") == 0;
+    }
+    PROTECT(s_new_obj = ScalarReal(f));
+    Ryaml_set_timestamp_class(s_new_obj, is_date);
+    SETCDR(*s_stack_tail, list1(s_new_obj));
+    *s_stack_tail = CDR(*s_stack_tail);
+    UNPROTECT(1); /* s_new_obj */
+
+    return 0;
+  }
+
+  /* Look for a custom R handler. The 'vanilla' string object is only
+   * made when a handler or the default handler needs it, so that numbers
+   * and booleans are converted straight from the scalar's bytes. */
   PROTECT(s_handler = Ryaml_find_handler(s_handlers, (const char *)tag));
   if (s_handler != R_NilValue) {
+    PROTECT(s_obj = ScalarString(mkCharCE(value, CE_UTF8)));
     if (Ryaml_run_handler(s_handler, s_obj, &s_new_obj) != 0) {
       warning("an error occurred when handling type '%s'; using default handler", tag);
     }
     else {
       handled = 1;
     }
+    UNPROTECT(1); /* s_obj */
+    s_obj = NULL;
   }
   UNPROTECT(1); /* s_handler */
 
@@ -200,7 +269,7 @@ static int handle_scalar(
     /* Default handlers */
 
     if (strcmp(tag, "str") == 0) {
-      /* already a string */
+      /* made below */
     }
     else if (strcmp(tag, "seq") == 0) {
       coercion_err = 1;
@@ -208,57 +277,31 @@ static int handle_scalar(
     else if (strcmp(tag, "int#na") == 0) {
       s_new_obj = ScalarInteger(NA_INTEGER);
     }
-    else if (strcmp(tag, "int") == 0 || strncmp(tag, "int#", 4) == 0) {
-      base = -1;
-      if (strcmp(tag, "int") == 0) {
-        base = 10;
-      }
-      else if (strcmp(tag, "int#hex") == 0) {
-        base = 16;
+    else if (strcmp(tag, "int") == 0 || strcmp(tag, "int#hex") == 0 || strcmp(tag, "int#oct") == 0) {
+      /* Explicit int tags may also be sexagesimal, but plain values that
+       * look like int#base60 are left as strings, since they are more
+       * often times of day than numbers. Only int#oct reads a leading 0
+       * as octal. */
+      if (!Ryaml_parse_int(value, len, schema, strcmp(tag, "int") != 0, &n,
+            &out_of_range)) {
+        /* R's as.integer() gives NA for a string that isn't completely an
+         * integer, so that behavior is reproduced here */
+        warning("NAs introduced by coercion: %s is not an integer", value);
+        n = NA_INTEGER;
+      } else if (out_of_range) {
+        warning("NAs introduced by coercion: %s is out of integer range", value);
+        n = NA_INTEGER;
       }
-      else if (strcmp(tag, "int#oct") == 0) {
-        base = 8;
-      }
-
-      if (base >= 0) {
-        errno = 0;
-        nptr = CHAR(STRING_ELT(s_obj, 0));
-        long_n = strtol(nptr, &endptr, base);
-        if (*endptr != 0) {
-          /* strtol is perfectly happy converting partial strings to
-           * integers, but R isn't. If you call as.integer() on a
-           * string that isn't completely an integer, you get back
-           * an NA. So I'm reproducing that behavior here. */
-
-          warning("NAs introduced by coercion: %s is not an integer", nptr);
-          n = NA_INTEGER;
-        } else if (errno == ERANGE) {
-          warning("NAs introduced by coercion: %s is out of integer range", nptr);
-          n = NA_INTEGER;
-        } else if (long_n < INT_MIN || long_n > INT_MAX || (int)long_n == NA_INTEGER) {
-          warning("NAs introduced by coercion: %s is out of integer range", nptr);
-          n = NA_INTEGER;
-        } else {
-          n = (int)long_n;
-        }
 
-        s_new_obj = ScalarInteger(n);
-      }
-      else {
-        /* unknown integer base; no-op */
-      }
+      s_new_obj = ScalarInteger(n);
     }
     else if (strcmp(tag, "float") == 0 || strcmp(tag, "float#fix") == 0 || strcmp(tag, "float#exp") == 0) {
-      errno = 0;
-      nptr = CHAR(STRING_ELT(s_obj, 0));
-      f = strtod(nptr, &endptr);
-      if (*endptr != 0) {
+      if (!Ryaml_parse_float(value, len, &f)) {
         /* No valid floats found (see note above about integers) */
-        warning("NAs introduced by coercion: %s is not a real", nptr);
-        f = NA_REAL;
-      } else if (errno == ERANGE || f == NA_REAL) {
-        warning("NAs introduced by coercion: %s is out of real range", nptr);
+        warning("NAs introduced by coercion: %s is not a real", value);
         f = NA_REAL;
+      } else if (ISNA(f)) {
+        warning("NAs introduced by coercion: %s is out of real range", value);
       }
 
       s_new_obj = ScalarReal(f);
@@ -318,13 +361,13 @@ static int handle_scalar(
     }
     else if (strcmp(tag, "expr") == 0) {
       if (eval_expr) {
-        PROTECT(s_obj);
+        PROTECT(s_obj = ScalarString(mkCharCE(value, CE_UTF8)));
         s_expr = R_ParseVector(s_obj, 1, &parse_status, R_NilValue);
         UNPROTECT(1);
 
         if (parse_status != PARSE_OK) {
           coercion_err = 1;
-          Ryaml_set_error_msg("Could not parse expression: %s", CHAR(STRING_ELT(s_obj, 0)));
+          Ryaml_set_error_msg(error_ctx, "Could not parse expression: %s", value);
         }
         else {
           /* NOTE: R_tryEval will not return if R_Interactive is FALSE. */
@@ -332,7 +375,7 @@ static int handle_scalar(
           PROTECT(s_new_obj = R_tryEval(VECTOR_ELT(s_expr, 0), R_GlobalEnv, &coercion_err));
 
           if (coercion_err) {
-            Ryaml_set_error_msg("Could not evaluate expression: %s", CHAR(STRING_ELT(s_obj, 0)));
+            Ryaml_set_error_msg(error_ctx, "Could not evaluate expression: %s", value);
           } 
           UNPROTECT(2); /* s_expr, s_new_obj */
         }
@@ -342,16 +385,18 @@ static int handle_scalar(
       }
     }
   }
-  UNPROTECT(1); /* s_obj */
 
   if (coercion_err == 1) {
-    if (Ryaml_error_msg[0] == 0) {
-      Ryaml_set_error_msg("Invalid tag for scalar: %s", tag);
+    if (error_ctx->msg[0] == 0) {
+      Ryaml_set_error_msg(error_ctx, "Invalid tag for scalar: %s", tag);
     }
     return 1;
   }
 
-  SETCDR(*s_stack_tail, list1(s_new_obj == NULL ? s_obj : s_new_obj));
+  if (s_new_obj == NULL) {
+    s_new_obj = ScalarString(mkCharCE(value, CE_UTF8));
+  }
+  SETCDR(*s_stack_tail, list1(s_new_obj));
   *s_stack_tail = CDR(*s_stack_tail);
 
   return 0;
@@ -402,11 +447,12 @@ static int handle_sequence(
   SEXP s_stack_head,
   SEXP *s_stack_tail,
   SEXP s_handlers,
-  int coerce_keys)
+  int coerce_keys,
+  s_error_context *error_ctx)
 {
   SEXP s_curr = NULL, s_obj = NULL, s_sequence_start = NULL, s_list = NULL,
        s_handler = NULL, s_new_obj = NULL, s_keys = NULL, s_key = NULL,
-       s_tag = NULL, s_inspect = NULL;
+       s_tag = NULL, s_inspect = NULL, s_class = NULL;
   int count = 0, i = 0, j = 0, type = 0, child_type = 0, handled = 0,
       coercion_err = 0, len = 0, total_len = 0, dup_key = 0, idx = 0,
       obj_len = 0;
@@ -425,7 +471,7 @@ static int handle_sequence(
     s_curr = CDR(s_curr);
   }
   if (s_sequence_start == NULL) {
-    Ryaml_set_error_msg("Internal error: couldn't find start of sequence!");
+    Ryaml_set_error_msg(error_ctx, "Internal error: couldn't find start of sequence!");
     return 1;
   }
 
@@ -454,6 +500,16 @@ static int handle_sequence(
         if (length(s_obj) != 1) {
           child_type = VECSXP;
         }
+        else if (child_type == REALSXP) {
+          /* Timestamps made by handle_scalar share their class vectors */
+          s_class = getAttrib(s_obj, R_ClassSymbol);
+          if (s_class == Ryaml_DateClass) {
+            child_type = DATE_TYPE;
+          }
+          else if (s_class == Ryaml_POSIXctClass) {
+            child_type = POSIXCT_TYPE;
+          }
+        }
         break;
     }
 
@@ -496,6 +552,13 @@ static int handle_sequence(
         case STRSXP:
           s_new_obj = coerceVector(s_list, type);
           break;
+
+        case DATE_TYPE:
+        case POSIXCT_TYPE:
+          PROTECT(s_new_obj = coerceVector(s_list, REALSXP));
+          Ryaml_set_timestamp_class(s_new_obj, type == DATE_TYPE);
+          UNPROTECT(1); /* s_new_obj */
+          break;
       }
     }
     else if (strcmp(tag, "str") == 0) {
@@ -519,6 +582,9 @@ static int handle_sequence(
     else if (strcmp(tag, "bool#na") == 0) {
       coercion_err = 1;
     }
+    else if (strcmp(tag, "binary") == 0) {
+      coercion_err = 1;
+    }
     else if (strcmp(tag, "omap") == 0) {
       /* NOTE: This is here mostly because of backwards compatibility
        * with R yaml 1.x package. All maps are ordered in 2.x, so there's
@@ -529,7 +595,7 @@ static int handle_sequence(
       for (i = 0; i < len; i++) {
         s_obj = VECTOR_ELT(s_list, i);
         if ((coerce_keys && !Ryaml_is_named_list(s_obj)) || (!coerce_keys && !Ryaml_is_pseudo_hash(s_obj))) {
-          Ryaml_set_error_msg("omap must be a sequence of maps");
+          Ryaml_set_error_msg(error_ctx, "omap must be a sequence of maps");
           coercion_err = 1;
           break;
         }
@@ -560,7 +626,7 @@ static int handle_sequence(
 
               if (Ryaml_index(s_keys, s_key, 1, idx) >= 0) {
                 dup_key = 1;
-                Ryaml_set_error_msg("Duplicate omap key: '%s'", CHAR(s_key));
+                Ryaml_set_error_msg(error_ctx, "Duplicate omap key: '%s'", CHAR(s_key));
               }
               UNPROTECT(1); /* s_key */
             }
@@ -573,7 +639,7 @@ static int handle_sequence(
 
                 PROTECT(s_inspect = Ryaml_inspect(s_key));
                 inspect = CHAR(STRING_ELT(s_inspect, 0));
-                Ryaml_set_error_msg("Duplicate omap key: %s", inspect);
+                Ryaml_set_error_msg(error_ctx, "Duplicate omap key: %s", inspect);
                 UNPROTECT(1);
               }
             }
@@ -615,8 +681,8 @@ static int handle_sequence(
   UNPROTECT(1); /* s_list */
 
   if (coercion_err == 1) {
-    if (Ryaml_error_msg[0] == 0) {
-      Ryaml_set_error_msg("Invalid tag: %s for sequence", tag);
+    if (error_ctx->msg[0] == 0) {
+      Ryaml_set_error_msg(error_ctx, "Invalid tag: %s for sequence", tag);
     }
     return 1;
   }
@@ -656,12 +722,15 @@ static SEXP find_map_entry(
   return NULL;
 }
 
+/* Return -1 on error or number of entries added to map. */
 static int expand_merge(
   SEXP s_merge_list,
   SEXP s_map_head,
   SEXP *s_map_tail,
   int coerce_keys,
-  int merge_warning)
+  int merge_warning,
+  s_load_limits *limits,
+  s_error_context *error_ctx)
 {
   SEXP s_merge_keys = NULL, s_value = NULL, s_key = NULL, s_result = NULL,
        s_inspect = NULL;
@@ -670,6 +739,13 @@ static int expand_merge(
 
   s_merge_keys = coerce_keys ? GET_NAMES(s_merge_list) : getAttrib(s_merge_list, Ryaml_KeysSymbol);
   for (i = 0; i < length(s_merge_list); i++) {
+    /* Aliases let a small document merge the same big map many times, so
+     * every key looked at counts, whether or not it ends up in the map */
+    if (limits->merge_keys >= 0 && ++limits->merge_keys_used > limits->merge_keys) {
+      Ryaml_set_error_msg(error_ctx, "Limit exceeded: merges use more than %ld keys", limits->merge_keys);
+      return -1;
+    }
+
     s_value = VECTOR_ELT(s_merge_list, i);
     if (coerce_keys) {
       s_key = STRING_ELT(s_merge_keys, i);
@@ -723,7 +799,8 @@ static int handle_map_entry(
   SEXP s_map_head,
   SEXP *s_map_tail,
   int coerce_keys,
-  int merge_warning)
+  int merge_warning,
+  s_error_context *error_ctx)
 {
   SEXP s_result = NULL, s_tag = NULL, s_inspect = NULL;
   const char *inspect = NULL;
@@ -763,7 +840,7 @@ static int handle_map_entry(
     }
 
     if (LOGICAL(CADR(s_tag))[0] == FALSE) {
-      Ryaml_set_error_msg("Duplicate map key: '%s'", inspect);
+      Ryaml_set_error_msg(error_ctx, "Duplicate map key: '%s'", inspect);
       count = -1;
     }
     else if (merge_warning) {
@@ -790,7 +867,9 @@ static int handle_merge(
   SEXP s_map_head,
   SEXP *s_map_tail,
   int coerce_keys,
-  int merge_warning)
+  int merge_warning,
+  s_load_limits *limits,
+  s_error_context *error_ctx)
 {
   SEXP s_obj = NULL, s_inspect = NULL;
   const char *inspect = NULL;
@@ -803,7 +882,7 @@ static int handle_merge(
      *        hello: friend
      *        <<: *bar
      */
-    count = expand_merge(s_value, s_map_head, s_map_tail, coerce_keys, merge_warning);
+    count = expand_merge(s_value, s_map_head, s_map_tail, coerce_keys, merge_warning, limits, error_ctx);
   }
   else if (TYPEOF(s_value) == VECSXP) {
     /* i.e.
@@ -817,7 +896,7 @@ static int handle_merge(
     for (i = 0; i < length(s_value); i++) {
       s_obj = VECTOR_ELT(s_value, i);
       if (is_mergeable(s_obj, coerce_keys)) {
-        len = expand_merge(s_obj, s_map_head, s_map_tail, coerce_keys, merge_warning);
+        len = expand_merge(s_obj, s_map_head, s_map_tail, coerce_keys, merge_warning, limits, error_ctx);
         if (len >= 0) {
           count += len;
         }
@@ -830,7 +909,7 @@ static int handle_merge(
         /* Illegal merge */
         PROTECT(s_inspect = Ryaml_inspect(s_value));
         inspect = CHAR(STRING_ELT(s_inspect, 0));
-        Ryaml_set_error_msg("Illegal merge: %s", inspect);
+        Ryaml_set_error_msg(error_ctx, "Illegal merge: %s", inspect);
         UNPROTECT(1);
 
         count = -1;
@@ -842,7 +921,7 @@ static int handle_merge(
     /* Illegal merge */
     PROTECT(s_inspect = Ryaml_inspect(s_value));
     inspect = CHAR(STRING_ELT(s_inspect, 0));
-    Ryaml_set_error_msg("Illegal merge: %s", inspect);
+    Ryaml_set_error_msg(error_ctx, "Illegal merge: %s", inspect);
     UNPROTECT(1);
 
     count = -1;
@@ -858,7 +937,9 @@ static int handle_map(
   SEXP s_handlers,
   int coerce_keys,
   int merge_override,
-  int merge_warning)
+  int merge_warning,
+  s_load_limits *limits,
+  s_error_context *error_ctx)
 {
   SEXP s_list = NULL, s_keys = NULL, s_key = NULL, s_value = NULL,
        s_prev = NULL, s_curr = NULL, s_mapping_start = NULL,
@@ -876,7 +957,7 @@ static int handle_map(
     s_curr = CDR(s_curr);
   }
   if (s_mapping_start == NULL) {
-    Ryaml_set_error_msg("Internal error: couldn't find start of mapping!");
+    Ryaml_set_error_msg(error_ctx, "Internal error: couldn't find start of mapping!");
     return 1;
   }
 
@@ -895,7 +976,7 @@ static int handle_map(
       s_value = CADR(s_curr);
 
       if (!Ryaml_has_class(s_key, "_yaml.merge_")) {
-        len = handle_map_entry(s_key, s_value, s_interim_map_head, &s_interim_map_tail, coerce_keys, merge_warning);
+        len = handle_map_entry(s_key, s_value, s_interim_map_head, &s_interim_map_tail, coerce_keys, merge_warning, error_ctx);
         if (len >= 0) {
           count += len;
 
@@ -923,17 +1004,17 @@ static int handle_map(
     s_curr = CDDR(s_curr);
 
     if (Ryaml_has_class(s_key, "_yaml.merge_")) {
-      len = handle_merge(s_value, s_interim_map_head, &s_interim_map_tail, coerce_keys, merge_warning);
+      len = handle_merge(s_value, s_interim_map_head, &s_interim_map_tail, coerce_keys, merge_warning, limits, error_ctx);
     }
     else {
       if (merge_override) {
         /* If merge override is turned on, merges should have already been processed. */
-        Ryaml_set_error_msg("Merge override failed");
+        Ryaml_set_error_msg(error_ctx, "Merge override failed");
         map_err = 1;
         break;
       }
 
-      len = handle_map_entry(s_key, s_value, s_interim_map_head, &s_interim_map_tail, coerce_keys, merge_warning);
+      len = handle_map_entry(s_key, s_value, s_interim_map_head, &s_interim_map_tail, coerce_keys, merge_warning, error_ctx);
     }
 
     if (len >= 0) {
@@ -1034,6 +1115,9 @@ static int handle_map(
     else if (strcmp(tag, "bool#na") == 0) {
       coercion_err = 1;
     }
+    else if (strcmp(tag, "binary") == 0) {
+      coercion_err = 1;
+    }
     else if (strcmp(tag, "omap") == 0) {
       coercion_err = 1;
     }
@@ -1064,8 +1148,8 @@ static int handle_map(
   }
 
   if (coercion_err == 1) {
-    if (Ryaml_error_msg[0] == 0) {
-      Ryaml_set_error_msg("Invalid tag: %s for map", original_tag);
+    if (error_ctx->msg[0] == 0) {
+      Ryaml_set_error_msg(error_ctx, "Invalid tag: %s for map", original_tag);
     }
     return 1;
   }
@@ -1089,261 +1173,2336 @@ static void possibly_record_alias(
   SET_TAG(*s_aliases_tail, s_anchor);
 }
 
-SEXP Ryaml_unserialize_from_yaml(
-  SEXP s_string,
-  SEXP s_as_named_list,
-  SEXP s_handlers,
-  SEXP s_error_label,
-  SEXP s_eval_expr,
-  SEXP s_eval_warning,
-  SEXP s_merge_precedence,
-  SEXP s_merge_warning)
+/* Collections that have been started but not finished yet, innermost last.
+ * With simplify = "data.frame", a sequence whose elements are maps with the
+ * same keys collects the maps' values into columns as each map ends,
+ * instead of keeping a list for every map. The column names and vectors are
+ * kept in the sequence start's tag (after the YAML tag and anchor), which
+ * protects them. A sequence typed by an atomic prototype keeps the vector
+ * its scalars are written into in the same place. */
+typedef enum {
+  FRAME_UNKNOWN,  /* no elements yet */
+  FRAME_ACTIVE,   /* all elements so far are in the columns */
+  FRAME_OFF       /* elements are on the stack as usual */
+} e_frame_state;
+
+typedef struct {
+  SEXP s_start;
+  int is_map;
+  e_frame_state frame;
+  int rows;
+  int capa;
+  SEXP s_prototype;
+  int typed;
+  int children;
+} s_structure;
+
+#define STRUCTURE_STACK_INITIAL_SIZE 32
+#define FRAME_INITIAL_ROWS 1024
+
+static void push_structure(
+  s_structure **structures,
+  int *depth,
+  int *size,
+  SEXP s_start,
+  int is_map)
 {
-  SEXP s_retval = NULL, s_stack_head = NULL, s_stack_tail = NULL,
-       s_aliases_head = NULL, s_aliases_tail = NULL, s_anchor = NULL;
-  yaml_parser_t parser;
-  yaml_event_t event;
-  const char *string = NULL, *error_label = NULL, *merge_precedence = NULL;
-  char *error_msg_copy = NULL;
-  long len = 0;
-  int as_named_list = 0, done = 0, err = 0, eval_expr = 0, eval_warning = 0,
-      merge_override = 0, merge_warning = 0;
+  s_structure *new_structures = NULL, *structure = NULL;
 
-  if (!isString(s_string) || length(s_string) != 1) {
-    error("string argument must be a character vector of length 1");
-    return R_NilValue;
+  if (*depth == *size) {
+    new_structures = (s_structure *)R_alloc(*size * 2, sizeof(s_structure));
+    memcpy(new_structures, *structures, sizeof(s_structure) * *size);
+    *structures = new_structures;
+    *size *= 2;
   }
 
-  if (!isLogical(s_as_named_list) || length(s_as_named_list) != 1) {
-    error("as.named.list argument must be a logical vector of length 1");
-    return R_NilValue;
-  }
+  structure = &(*structures)[(*depth)++];
+  structure->s_start = s_start;
+  structure->is_map = is_map;
+  structure->frame = FRAME_UNKNOWN;
+  structure->rows = structure->capa = 0;
+  structure->s_prototype = R_NilValue;
+  structure->typed = 0;
+  structure->children = 0;
+}
 
-  if (s_error_label == R_NilValue) {
-    error_label = NULL;
-  }
-  else if (!isString(s_error_label) || length(s_error_label) != 1) {
-    error("error.label argument must be either NULL or a character vector of length 1");
-    return R_NilValue;
-  } else {
-    error_label = CHAR(STRING_ELT(s_error_label, 0));
+/* Whether a map value can go into a data.frame column */
+static int is_frame_value(SEXP s_obj)
+{
+  switch (TYPEOF(s_obj)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case STRSXP:
+      return LENGTH(s_obj) == 1 &&
+        getAttrib(s_obj, R_ClassSymbol) == R_NilValue &&
+        getAttrib(s_obj, R_NamesSymbol) == R_NilValue;
   }
+  return 0;
+}
 
-  if (!isLogical(s_eval_expr) || length(s_eval_expr) != 1) {
-    error("eval.expr argument must be a logical vector of length 1");
-    return R_NilValue;
-  }
+/* Check that the map that just ended (whose key/value pairs follow
+ * s_mapping_start on the stack) can be a row of the sequence's data.frame,
+ * and count its pairs. The first row decides the names and column types. */
+static int is_frame_row(SEXP s_mapping_start, SEXP s_names, SEXP s_columns, int *count)
+{
+  SEXP s_curr = NULL, s_key = NULL, s_value = NULL, s_prev = NULL;
+  int i = 0, j = 0;
 
-  if (!isLogical(s_eval_warning) || length(s_eval_warning) != 1) {
-    error("eval.warning argument must be a logical vector of length 1");
-    return R_NilValue;
+  /* The map itself can't have a tag or anchor */
+  if (CAR(TAG(s_mapping_start)) != R_NilValue || CADR(TAG(s_mapping_start)) != R_NilValue) {
+    return 0;
   }
 
-  if (!isString(s_merge_precedence) || length(s_merge_precedence) != 1) {
-    error("merge.precedence argument must be a character vector of length 1");
-    return R_NilValue;
-  }
-  else {
-    merge_precedence = CHAR(STRING_ELT(s_merge_precedence, 0));
-    if (strcmp(merge_precedence, "order") == 0) {
-      merge_override = 0;
+  for (s_curr = CDR(s_mapping_start); s_curr != R_NilValue; s_curr = CDDR(s_curr), i++) {
+    s_key = CAR(s_curr);
+    s_value = CADR(s_curr);
+
+    if (TYPEOF(s_key) != STRSXP || !is_frame_value(s_key) ||
+        STRING_ELT(s_key, 0) == NA_STRING || !is_frame_value(s_value)) {
+      return 0;
     }
-    else if (strcmp(merge_precedence, "override") == 0) {
-      merge_override = 1;
+
+    if (s_names == R_NilValue) {
+      /* Keys of the first row have to be unique */
+      for (s_prev = CDR(s_mapping_start), j = 0; j < i; s_prev = CDDR(s_prev), j++) {
+        if (strcmp(CHAR(STRING_ELT(CAR(s_prev), 0)), CHAR(STRING_ELT(s_key, 0))) == 0) {
+          return 0;
+        }
+      }
     }
     else {
-      error("merge.precedence must be either 'ordered' or 'override'");
-      return R_NilValue;
+      if (i >= LENGTH(s_names) ||
+          (STRING_ELT(s_key, 0) != STRING_ELT(s_names, i) &&
+           strcmp(CHAR(STRING_ELT(s_key, 0)), CHAR(STRING_ELT(s_names, i))) != 0) ||
+          TYPEOF(s_value) != TYPEOF(VECTOR_ELT(s_columns, i))) {
+        return 0;
+      }
     }
   }
 
-  if (!isLogical(s_merge_warning) || length(s_merge_warning) != 1) {
-    error("merge.warning argument must be a logical vector of length 1");
-    return R_NilValue;
+  if (i == 0 || (s_names != R_NilValue && i != LENGTH(s_names))) {
+    return 0;
   }
+  *count = i;
 
-  PROTECT(s_handlers = Ryaml_sanitize_handlers(s_handlers));
+  return 1;
+}
 
-  string = CHAR(STRING_ELT(s_string, 0));
-  len = length(STRING_ELT(s_string, 0));
-  as_named_list = LOGICAL(s_as_named_list)[0];
-  eval_expr = LOGICAL(s_eval_expr)[0];
-  eval_warning = LOGICAL(s_eval_warning)[0];
-  merge_warning = LOGICAL(s_merge_warning)[0];
+/* Put the values of the map that just ended into the columns of its
+ * sequence's data.frame and take the map off the stack. Returns 0 if the
+ * map doesn't fit, in which case nothing is changed. */
+static int append_frame_row(
+  s_structure *sequence,
+  s_structure *mapping,
+  SEXP *s_stack_tail)
+{
+  SEXP s_names = R_NilValue, s_columns = R_NilValue, s_curr = NULL,
+       s_value = NULL, s_column = NULL;
+  int count = 0, i = 0, row = 0;
 
-  yaml_parser_initialize(&parser);
-  yaml_parser_set_input_string(&parser, (const unsigned char *)string, len);
+  if (sequence->frame == FRAME_ACTIVE) {
+    s_names = CADDR(TAG(sequence->s_start));
+    s_columns = CADDDR(TAG(sequence->s_start));
+  }
 
-  PROTECT(s_stack_head = s_stack_tail = list1(Ryaml_Sentinel));
-  PROTECT(s_aliases_head = s_aliases_tail = list1(Ryaml_Sentinel));
-  Ryaml_error_msg[0] = 0;
-  while (!done) {
-    if (yaml_parser_parse(&parser, &event)) {
-      err = 0;
+  if (!is_frame_row(mapping->s_start, s_names, s_columns, &count)) {
+    return 0;
+  }
 
-      switch (event.type) {
-        case YAML_NO_EVENT:
-        case YAML_STREAM_START_EVENT:
-        case YAML_DOCUMENT_START_EVENT:
-        case YAML_DOCUMENT_END_EVENT:
-          break;
+  if (sequence->frame == FRAME_UNKNOWN) {
+    PROTECT(s_names = allocVector(STRSXP, count));
+    PROTECT(s_columns = allocVector(VECSXP, count));
+    s_curr = CDR(mapping->s_start);
+    for (i = 0; i < count; i++, s_curr = CDDR(s_curr)) {
+      SET_STRING_ELT(s_names, i, STRING_ELT(CAR(s_curr), 0));
+      SET_VECTOR_ELT(s_columns, i, allocVector(TYPEOF(CADR(s_curr)), FRAME_INITIAL_ROWS));
+    }
+    SETCDR(CDR(TAG(sequence->s_start)), list2(s_names, s_columns));
+    UNPROTECT(2); /* s_names, s_columns */
 
-        case YAML_ALIAS_EVENT:
-#if DEBUG
-          Rprintf("ALIAS: %s\n", event.data.alias.anchor);
-#endif
-          handle_alias(&event, &s_stack_tail, s_aliases_head);
-          break;
+    sequence->frame = FRAME_ACTIVE;
+    sequence->capa = FRAME_INITIAL_ROWS;
+  }
+  else if (sequence->rows == sequence->capa) {
+    sequence->capa *= 2;
+    for (i = 0; i < count; i++) {
+      SET_VECTOR_ELT(s_columns, i, xlengthgets(VECTOR_ELT(s_columns, i), sequence->capa));
+    }
+  }
 
-        case YAML_SCALAR_EVENT:
-#if DEBUG
-          Rprintf("SCALAR: %s (%s) [%s]\n", event.data.scalar.value, event.data.scalar.tag, event.data.scalar.anchor);
-#endif
-          err = handle_scalar(&event, &s_stack_tail, s_handlers, eval_expr, eval_warning);
-          if (!err && event.data.scalar.anchor != NULL) {
-            PROTECT(s_anchor = mkCharCE((char *)event.data.scalar.anchor, CE_UTF8));
-            possibly_record_alias(s_anchor, &s_aliases_tail, CAR(s_stack_tail));
-            UNPROTECT(1);
-          }
-          break;
+  row = sequence->rows++;
+  s_curr = CDR(mapping->s_start);
+  for (i = 0; i < count; i++, s_curr = CDDR(s_curr)) {
+    s_value = CADR(s_curr);
+    s_column = VECTOR_ELT(s_columns, i);
+    switch (TYPEOF(s_column)) {
+      case LGLSXP:
+        LOGICAL(s_column)[row] = LOGICAL(s_value)[0];
+        break;
+      case INTSXP:
+        INTEGER(s_column)[row] = INTEGER(s_value)[0];
+        break;
+      case REALSXP:
+        REAL(s_column)[row] = REAL(s_value)[0];
+        break;
+      case STRSXP:
+        SET_STRING_ELT(s_column, row, STRING_ELT(s_value, 0));
+        break;
+    }
+  }
 
-        case YAML_SEQUENCE_START_EVENT:
-#if DEBUG
-          Rprintf("SEQUENCE START: (%s) [%s]\n", event.data.sequence_start.tag, event.data.sequence_start.anchor);
-#endif
-          handle_structure_start(&event, &s_stack_tail, 0);
-          break;
+  /* The sequence has nothing else on the stack */
+  SETCDR(sequence->s_start, R_NilValue);
+  *s_stack_tail = sequence->s_start;
 
-        case YAML_SEQUENCE_END_EVENT:
-#if DEBUG
-          Rprintf("SEQUENCE END\n");
-#endif
-          err = handle_sequence(&event, s_stack_head, &s_stack_tail, s_handlers, as_named_list);
-          if (!err) {
-            s_anchor = CADR(TAG(s_stack_tail));
-            possibly_record_alias(s_anchor, &s_aliases_tail, CAR(s_stack_tail));
-            SET_TAG(s_stack_tail, R_NilValue);
-          }
-          break;
+  return 1;
+}
 
-        case YAML_MAPPING_START_EVENT:
-#if DEBUG
-          Rprintf("MAPPING START: (%s) [%s]\n", event.data.mapping_start.tag, event.data.mapping_start.anchor);
-#endif
-          handle_structure_start(&event, &s_stack_tail, 1);
-          break;
+/* Stop collecting a sequence into columns, because an element came along
+ * that doesn't fit. The rows collected so far are turned back into lists
+ * and put on the stack ahead of anything already after the sequence
+ * start. */
+static void flush_frame_rows(s_structure *sequence, SEXP *s_stack_tail)
+{
+  SEXP s_names = NULL, s_columns = NULL, s_column = NULL, s_rows_head = NULL,
+       s_rows_tail = NULL, s_row = NULL, s_rest = NULL;
+  int count = 0, i = 0, j = 0;
 
-        case YAML_MAPPING_END_EVENT:
-#if DEBUG
-          Rprintf("MAPPING END\n");
-#endif
-          err = handle_map(&event, s_stack_head, &s_stack_tail, s_handlers, as_named_list, merge_override, merge_warning);
-          if (!err) {
-            s_anchor = CADR(TAG(s_stack_tail));
-            possibly_record_alias(s_anchor, &s_aliases_tail, CAR(s_stack_tail));
-            SET_TAG(s_stack_tail, R_NilValue);
-          }
+  if (sequence->frame != FRAME_ACTIVE) {
+    sequence->frame = FRAME_OFF;
+    return;
+  }
 
+  s_names = CADDR(TAG(sequence->s_start));
+  s_columns = CADDDR(TAG(sequence->s_start));
+  count = LENGTH(s_names);
+  MARK_NOT_MUTABLE(s_names);
+
+  PROTECT(s_rows_head = s_rows_tail = list1(R_NilValue));
+  for (i = 0; i < sequence->rows; i++) {
+    SETCDR(s_rows_tail, list1(R_NilValue));
+    s_rows_tail = CDR(s_rows_tail);
+    s_row = allocVector(VECSXP, count);
+    SETCAR(s_rows_tail, s_row);
+
+    for (j = 0; j < count; j++) {
+      s_column = VECTOR_ELT(s_columns, j);
+      switch (TYPEOF(s_column)) {
+        case LGLSXP:
+          SET_VECTOR_ELT(s_row, j, ScalarLogical(LOGICAL(s_column)[i]));
           break;
-
-        case YAML_STREAM_END_EVENT:
-          if (CADR(s_stack_head) != Ryaml_Sentinel) {
-            s_retval = CADR(s_stack_head);
-          }
-          else {
-            s_retval = R_NilValue;
-          }
-
-          done = 1;
+        case INTSXP:
+          SET_VECTOR_ELT(s_row, j, ScalarInteger(INTEGER(s_column)[i]));
+          break;
+        case REALSXP:
+          SET_VECTOR_ELT(s_row, j, ScalarReal(REAL(s_column)[i]));
+          break;
+        case STRSXP:
+          SET_VECTOR_ELT(s_row, j, ScalarString(STRING_ELT(s_column, i)));
           break;
-      }
-
-      if (err) {
-        s_retval = R_NilValue;
-        done = 1;
       }
     }
-    else {
-      s_retval = R_NilValue;
+    SET_NAMES(s_row, s_names);
+  }
 
-      /* Parser error */
-      switch (parser.error) {
-        case YAML_MEMORY_ERROR:
-          Ryaml_set_error_msg("Memory error: Not enough memory for parsing");
-          break;
+  s_rest = CDR(sequence->s_start);
+  SETCDR(sequence->s_start, CDR(s_rows_head));
+  SETCDR(s_rows_tail, s_rest);
+  if (*s_stack_tail == sequence->s_start) {
+    *s_stack_tail = s_rows_tail;
+  }
+  UNPROTECT(1); /* s_rows_head */
 
-        case YAML_READER_ERROR:
-          if (parser.problem_value != -1) {
-            Ryaml_set_error_msg("Reader error: %s: #%X at %d", parser.problem,
-              parser.problem_value, (int)parser.problem_offset);
-          }
-          else {
-            Ryaml_set_error_msg("Reader error: %s at %d", parser.problem,
-              (int)parser.problem_offset);
-          }
-          break;
+  SETCDR(CDR(TAG(sequence->s_start)), R_NilValue);
+  sequence->frame = FRAME_OFF;
+}
 
-        case YAML_SCANNER_ERROR:
-          if (parser.context) {
-            Ryaml_set_error_msg("Scanner error: %s at line %d, column %d "
-              "%s at line %d, column %d\n", parser.context,
-              (int)parser.context_mark.line+1,
-              (int)parser.context_mark.column+1,
-              parser.problem, (int)parser.problem_mark.line+1,
-              (int)parser.problem_mark.column+1);
-          }
-          else {
-            Ryaml_set_error_msg("Scanner error: %s at line %d, column %d",
-              parser.problem, (int)parser.problem_mark.line+1,
-              (int)parser.problem_mark.column+1);
-          }
-          break;
+/* Replace a finished sequence with the data.frame made from its columns */
+static void finish_frame(s_structure *sequence, SEXP *s_stack_tail)
+{
+  SEXP s_names = NULL, s_columns = NULL, s_row_names = NULL;
+  int i = 0;
 
-        case YAML_PARSER_ERROR:
-          if (parser.context) {
-            Ryaml_set_error_msg("Parser error: %s at line %d, column %d "
-              "%s at line %d, column %d", parser.context,
-              (int)parser.context_mark.line+1,
-              (int)parser.context_mark.column+1,
-              parser.problem, (int)parser.problem_mark.line+1,
-              (int)parser.problem_mark.column+1);
-          }
-          else {
-            Ryaml_set_error_msg("Parser error: %s at line %d, column %d",
-              parser.problem, (int)parser.problem_mark.line+1,
-              (int)parser.problem_mark.column+1);
-          }
-          break;
+  s_names = CADDR(TAG(sequence->s_start));
+  s_columns = CADDDR(TAG(sequence->s_start));
+  for (i = 0; i < LENGTH(s_columns); i++) {
+    SET_VECTOR_ELT(s_columns, i, xlengthgets(VECTOR_ELT(s_columns, i), sequence->rows));
+  }
 
-        default:
-          /* Couldn't happen unless there is an undocumented/unhandled error
-           * from LibYAML. */
-          Ryaml_set_error_msg("Internal error: unknown parser error");
-          break;
-      }
-      done = 1;
-    }
+  /* Compact row names, like data.frame() uses */
+  PROTECT(s_row_names = allocVector(INTSXP, 2));
+  INTEGER(s_row_names)[0] = NA_INTEGER;
+  INTEGER(s_row_names)[1] = -sequence->rows;
+  setAttrib(s_columns, R_RowNamesSymbol, s_row_names);
+  UNPROTECT(1); /* s_row_names */
+  SET_NAMES(s_columns, s_names);
+  setAttrib(s_columns, R_ClassSymbol, mkString("data.frame"));
+
+  SETCAR(sequence->s_start, s_columns);
+  SETCDR(sequence->s_start, R_NilValue);
+  *s_stack_tail = sequence->s_start;
+}
 
-    yaml_event_delete(&event);
-  }
-  yaml_parser_delete(&parser);
+/* With a prototype, the R type of each node is known before it is loaded.
+ * An atomic vector stands for a scalar or a sequence of scalars of its
+ * type, an unnamed list for a sequence of elements like its only element
+ * (or of anything, if it is empty), and a named list for a map whose values
+ * are like the elements with the same names. NULL allows anything. */
+#define TYPED_INITIAL_SIZE 16
 
-  if (Ryaml_error_msg[0] != 0) {
-    /* Prepend label to error message if specified */
-    if (error_label != NULL) {
-      error_msg_copy = (char *)malloc(sizeof(char) * ERROR_MSG_SIZE);
-      if (error_msg_copy == NULL) {
-        Ryaml_set_error_msg("Ran out of memory!");
-      } else {
-        memcpy(error_msg_copy, Ryaml_error_msg, ERROR_MSG_SIZE);
-        Ryaml_set_error_msg("(%s) %s", error_label, error_msg_copy);
-        free(error_msg_copy);
+static int is_atomic_prototype(SEXP s_prototype)
+{
+  switch (TYPEOF(s_prototype)) {
+    case LGLSXP:
+    case INTSXP:
+    case REALSXP:
+    case STRSXP:
+      return 1;
+  }
+  return 0;
+}
+
+static int is_valid_prototype(SEXP s_prototype)
+{
+  R_xlen_t i = 0;
+
+  if (s_prototype == R_NilValue || (is_atomic_prototype(s_prototype) && !OBJECT(s_prototype))) {
+    return 1;
+  }
+  if (TYPEOF(s_prototype) != VECSXP || OBJECT(s_prototype) ||
+      (getAttrib(s_prototype, R_NamesSymbol) == R_NilValue && XLENGTH(s_prototype) > 1)) {
+    return 0;
+  }
+  for (i = 0; i < XLENGTH(s_prototype); i++) {
+    if (!is_valid_prototype(VECTOR_ELT(s_prototype, i))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static const char *describe_prototype(SEXP s_prototype)
+{
+  switch (TYPEOF(s_prototype)) {
+    case LGLSXP:
+      return "a logical";
+    case INTSXP:
+      return "an integer";
+    case REALSXP:
+      return "a number";
+    case STRSXP:
+      return "a string";
+    case VECSXP:
+      return getAttrib(s_prototype, R_NamesSymbol) == R_NilValue ? "a sequence" : "a map";
+  }
+  return "anything";
+}
+
+static int set_prototype_error(yaml_event_t *event, SEXP s_prototype, s_error_context *error_ctx)
+{
+  const char *expected = describe_prototype(s_prototype);
+  int line = (int)event->start_mark.line + 1, column = (int)event->start_mark.column + 1;
+
+  switch (event->type) {
+    case YAML_SCALAR_EVENT:
+      Ryaml_set_error_msg(error_ctx, "Type mismatch at line %d, column %d: expected %s, found '%.40s'",
+        line, column, expected, (const char *)event->data.scalar.value);
+      break;
+    case YAML_ALIAS_EVENT:
+      Ryaml_set_error_msg(error_ctx, "Type mismatch at line %d, column %d: expected %s, found *%.40s",
+        line, column, expected, (const char *)event->data.alias.anchor);
+      break;
+    default:
+      Ryaml_set_error_msg(error_ctx, "Type mismatch at line %d, column %d: expected %s, found %s",
+        line, column, expected, event->type == YAML_MAPPING_START_EVENT ? "a map" : "a sequence");
+      break;
+  }
+
+  return 1;
+}
+
+/* Prototype of the next node in structure. Keys of maps have none. */
+static SEXP child_prototype(s_structure *structure, SEXP s_stack_tail)
+{
+  SEXP s_prototype = structure->s_prototype, s_names = NULL, s_key = NULL;
+  R_xlen_t i = 0;
+
+  if (s_prototype == R_NilValue) {
+    return R_NilValue;
+  }
+  if (!structure->is_map) {
+    if (is_atomic_prototype(s_prototype)) {
+      return s_prototype;
+    }
+    return XLENGTH(s_prototype) == 1 ? VECTOR_ELT(s_prototype, 0) : R_NilValue;
+  }
+
+  if (structure->children % 2 == 0) {
+    return R_NilValue;
+  }
+  s_key = CAR(s_stack_tail);
+  s_names = getAttrib(s_prototype, R_NamesSymbol);
+  if (TYPEOF(s_key) != STRSXP || XLENGTH(s_key) != 1 || STRING_ELT(s_key, 0) == NA_STRING) {
+    return R_NilValue;
+  }
+  for (i = 0; i < XLENGTH(s_names); i++) {
+    if (strcmp(CHAR(STRING_ELT(s_names, i)), CHAR(STRING_ELT(s_key, 0))) == 0) {
+      return VECTOR_ELT(s_prototype, i);
+    }
+  }
+
+  return R_NilValue;
+}
+
+/* Check that the node an event starts can have the prototype */
+static int check_prototype(yaml_event_t *event, SEXP s_prototype, s_error_context *error_ctx)
+{
+  int is_list = TYPEOF(s_prototype) == VECSXP,
+      is_map = is_list && getAttrib(s_prototype, R_NamesSymbol) != R_NilValue;
+
+  if (s_prototype == R_NilValue) {
+    return 0;
+  }
+
+  switch (event->type) {
+    case YAML_SCALAR_EVENT:
+      if (is_list) {
+        return set_prototype_error(event, s_prototype, error_ctx);
+      }
+      break;
+    case YAML_SEQUENCE_START_EVENT:
+      if (is_map) {
+        return set_prototype_error(event, s_prototype, error_ctx);
+      }
+      break;
+    case YAML_MAPPING_START_EVENT:
+      if (!is_map) {
+        return set_prototype_error(event, s_prototype, error_ctx);
+      }
+      break;
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+static void copy_typed_element(SEXP s_dest, R_xlen_t i, SEXP s_src, R_xlen_t j)
+{
+  switch (TYPEOF(s_dest)) {
+    case LGLSXP:
+      LOGICAL(s_dest)[i] = LOGICAL(s_src)[j];
+      break;
+    case INTSXP:
+      INTEGER(s_dest)[i] = INTEGER(s_src)[j];
+      break;
+    case REALSXP:
+      REAL(s_dest)[i] = REAL(s_src)[j];
+      break;
+    case STRSXP:
+      SET_STRING_ELT(s_dest, i, STRING_ELT(s_src, j));
+      break;
+  }
+}
+
+/* Convert a scalar straight to the type of s_vector, without finding its
+ * implicit tag first, and write it to element i. Tags and handlers don't
+ * apply. Plain nulls become NA. Returns 1 with the error set if the scalar
+ * isn't of that type, instead of coercing it. */
+static int convert_typed_scalar(
+  yaml_event_t *event,
+  SEXP s_vector,
+  R_xlen_t i,
+  int schema,
+  s_error_context *error_ctx)
+{
+  const char *value = NULL, *tag = NULL;
+  size_t len = 0;
+  int n = 0, out_of_range = 0, is_null = 0, ok = 1;
+  double f = 0;
+
+  value = (const char *)event->data.scalar.value;
+  len = event->data.scalar.length;
+  is_null = event->data.scalar.style == YAML_PLAIN_SCALAR_STYLE && len <= 4 &&
+    strcmp(Ryaml_find_schema_tag(value, len, schema), "null") == 0;
+
+  switch (TYPEOF(s_vector)) {
+    case LGLSXP:
+      n = NA_LOGICAL;
+      if (!is_null) {
+        tag = Ryaml_find_schema_tag(value, len, schema == SCHEMA_FAILSAFE ? SCHEMA_CORE : schema);
+        if (strcmp(tag, "bool#yes") == 0) {
+          n = TRUE;
+        }
+        else if (strcmp(tag, "bool#no") == 0) {
+          n = FALSE;
+        }
+        else {
+          ok = strcmp(tag, "bool#na") == 0;
+        }
+      }
+      LOGICAL(s_vector)[i] = n;
+      break;
+
+    case INTSXP:
+      n = NA_INTEGER;
+      if (!is_null && !Ryaml_parse_int(value, len, schema, 1, &n, &out_of_range)) {
+        ok = strcmp(Ryaml_find_schema_tag(value, len, schema), "int#na") == 0;
+        n = NA_INTEGER;
+      }
+      else if (out_of_range) {
+        Ryaml_set_error_msg(error_ctx, "Type mismatch at line %d, column %d: %.40s is out of integer range",
+          (int)event->start_mark.line + 1, (int)event->start_mark.column + 1, value);
+        return 1;
+      }
+      INTEGER(s_vector)[i] = n;
+      break;
+
+    case REALSXP:
+      f = NA_REAL;
+      if (!is_null && !Ryaml_parse_float(value, len, &f)) {
+        tag = Ryaml_find_schema_tag(value, len, schema);
+        if (strcmp(tag, "float#inf") == 0) {
+          f = R_PosInf;
+        }
+        else if (strcmp(tag, "float#neginf") == 0) {
+          f = R_NegInf;
+        }
+        else if (strcmp(tag, "float#nan") == 0) {
+          f = R_NaN;
+        }
+        else {
+          ok = strcmp(tag, "float#na") == 0;
+          f = NA_REAL;
+        }
+      }
+      else if (!is_null && ISNA(f)) {
+        Ryaml_set_error_msg(error_ctx, "Type mismatch at line %d, column %d: %.40s is out of real range",
+          (int)event->start_mark.line + 1, (int)event->start_mark.column + 1, value);
+        return 1;
+      }
+      REAL(s_vector)[i] = f;
+      break;
+
+    case STRSXP:
+      SET_STRING_ELT(s_vector, i, is_null ? NA_STRING : mkCharCE(value, CE_UTF8));
+      break;
+  }
+
+  if (!ok) {
+    return set_prototype_error(event, s_vector, error_ctx);
+  }
+
+  return 0;
+}
+
+/* Push a scalar converted to the type of an atomic prototype */
+static int handle_typed_scalar(
+  yaml_event_t *event,
+  SEXP *s_stack_tail,
+  SEXP s_prototype,
+  int schema,
+  s_error_context *error_ctx)
+{
+  SEXP s_obj = NULL;
+
+  PROTECT(s_obj = allocVector(TYPEOF(s_prototype), 1));
+  if (convert_typed_scalar(event, s_obj, 0, schema, error_ctx)) {
+    UNPROTECT(1); /* s_obj */
+    return 1;
+  }
+  SETCDR(*s_stack_tail, list1(s_obj));
+  *s_stack_tail = CDR(*s_stack_tail);
+  UNPROTECT(1); /* s_obj */
+
+  return 0;
+}
+
+/* Start writing the scalars of a sequence straight into a vector of the
+ * prototype's type, which is as long as the prototype to begin with */
+static void start_typed_sequence(s_structure *sequence, SEXP s_prototype)
+{
+  sequence->capa = XLENGTH(s_prototype) > 0 ? (int)XLENGTH(s_prototype) : TYPED_INITIAL_SIZE;
+  SETCDR(CDR(TAG(sequence->s_start)), list1(allocVector(TYPEOF(s_prototype), sequence->capa)));
+  sequence->typed = 1;
+  sequence->frame = FRAME_OFF;
+}
+
+/* Make room for one more element in a typed sequence's vector and return
+ * it */
+static SEXP grow_typed_sequence(s_structure *sequence)
+{
+  SEXP s_vector = CADDR(TAG(sequence->s_start));
+
+  if (sequence->rows == sequence->capa) {
+    sequence->capa *= 2;
+    s_vector = xlengthgets(s_vector, sequence->capa);
+    SETCAR(CDDR(TAG(sequence->s_start)), s_vector);
+  }
+
+  return s_vector;
+}
+
+/* Add a scalar to a typed sequence. If it has an anchor, a copy of the
+ * element is returned in s_obj for aliases to refer to. */
+static int append_typed_scalar(
+  s_structure *sequence,
+  yaml_event_t *event,
+  int schema,
+  SEXP *s_obj,
+  s_error_context *error_ctx)
+{
+  SEXP s_vector = grow_typed_sequence(sequence);
+  int i = sequence->rows;
+
+  if (convert_typed_scalar(event, s_vector, i, schema, error_ctx)) {
+    return 1;
+  }
+  sequence->rows++;
+
+  if (event->data.scalar.anchor != NULL) {
+    *s_obj = allocVector(TYPEOF(s_vector), 1);
+    copy_typed_element(*s_obj, 0, s_vector, i);
+  }
+
+  return 0;
+}
+
+/* Add the value of an alias to a typed sequence. It has to be a single
+ * value of the same type. */
+static int append_typed_alias(
+  s_structure *sequence,
+  yaml_event_t *event,
+  SEXP s_aliases_head,
+  s_error_context *error_ctx)
+{
+  SEXP s_vector = grow_typed_sequence(sequence), s_obj = NULL;
+
+  s_obj = find_alias(event, s_aliases_head);
+  if (s_obj == NULL || TYPEOF(s_obj) != TYPEOF(s_vector) || XLENGTH(s_obj) != 1) {
+    return set_prototype_error(event, s_vector, error_ctx);
+  }
+  copy_typed_element(s_vector, sequence->rows++, s_obj, 0);
+
+  return 0;
+}
+
+/* Replace a finished typed sequence with its vector */
+static void finish_typed_sequence(s_structure *sequence, SEXP *s_stack_tail)
+{
+  SEXP s_vector = CADDR(TAG(sequence->s_start));
+
+  if (sequence->rows != sequence->capa) {
+    s_vector = xlengthgets(s_vector, sequence->rows);
+  }
+  SETCAR(sequence->s_start, s_vector);
+  SETCDR(sequence->s_start, R_NilValue);
+  *s_stack_tail = sequence->s_start;
+}
+
+/* Read the limits argument, which is NULL or a named list with any of
+ * depth, nodes, scalar.size and merge.keys. Inf means no limit. */
+static void get_limits(SEXP s_limits, s_load_limits *limits)
+{
+  SEXP s_names = NULL, s_value = NULL;
+  const char *name = NULL;
+  double value = 0;
+  long *field = NULL;
+  int i = 0;
+
+  limits->depth = limits->nodes = limits->scalar_size = limits->merge_keys = -1;
+  limits->merge_keys_used = 0;
+  if (s_limits == R_NilValue) {
+    return;
+  }
+
+  s_names = GET_NAMES(s_limits);
+  if (TYPEOF(s_limits) != VECSXP || (length(s_limits) > 0 && s_names == R_NilValue)) {
+    error("limits argument must be either NULL or a named list");
+  }
+
+  for (i = 0; i < length(s_limits); i++) {
+    name = CHAR(STRING_ELT(s_names, i));
+    if (strcmp(name, "depth") == 0) {
+      field = &limits->depth;
+    }
+    else if (strcmp(name, "nodes") == 0) {
+      field = &limits->nodes;
+    }
+    else if (strcmp(name, "scalar.size") == 0) {
+      field = &limits->scalar_size;
+    }
+    else if (strcmp(name, "merge.keys") == 0) {
+      field = &limits->merge_keys;
+    }
+    else {
+      error("unknown limit: '%s'", name);
+    }
+
+    s_value = VECTOR_ELT(s_limits, i);
+    value = isNumeric(s_value) && length(s_value) == 1 ? asReal(s_value) : NA_REAL;
+    if (ISNAN(value) || value < 0) {
+      error("limit '%s' must be a single non-negative number", name);
+    }
+    *field = value >= (double)LONG_MAX ? -1 : (long)value;
+  }
+}
+
+/* Stop before handling an event that would go over one of the limits */
+static int check_limits(
+  yaml_event_t *event,
+  s_load_limits *limits,
+  int depth,
+  long *nodes,
+  s_error_context *error_ctx)
+{
+  switch (event->type) {
+    case YAML_SEQUENCE_START_EVENT:
+    case YAML_MAPPING_START_EVENT:
+      if (limits->depth >= 0 && depth >= limits->depth) {
+        Ryaml_set_error_msg(error_ctx, "Limit exceeded: more than %ld nested sequences and maps at line %d, column %d",
+          limits->depth, (int)event->start_mark.line+1, (int)event->start_mark.column+1);
+        return 1;
+      }
+      break;
+
+    case YAML_SCALAR_EVENT:
+      if (limits->scalar_size >= 0 && event->data.scalar.length > (size_t)limits->scalar_size) {
+        Ryaml_set_error_msg(error_ctx, "Limit exceeded: scalar of more than %ld bytes at line %d, column %d",
+          limits->scalar_size, (int)event->start_mark.line+1, (int)event->start_mark.column+1);
+        return 1;
+      }
+      break;
+
+    case YAML_ALIAS_EVENT:
+      break;
+
+    default:
+      return 0;
+  }
+
+  if (limits->nodes >= 0 && ++(*nodes) > limits->nodes) {
+    Ryaml_set_error_msg(error_ctx, "Limit exceeded: more than %ld nodes at line %d, column %d",
+      limits->nodes, (int)event->start_mark.line+1, (int)event->start_mark.column+1);
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Loader options passed in from R, after checking */
+typedef struct {
+  int as_named_list;
+  int eval_expr;
+  int eval_warning;
+  int merge_override;
+  int merge_warning;
+  int timestamps;
+  int frames;
+  int schema;
+  SEXP s_handlers;
+  SEXP s_prototype;
+  s_load_limits limits;
+} s_load_options;
+
+/* Events of one document that were parsed ahead of time, possibly on a
+ * worker thread. If the parser failed, the events up to the failure are
+ * followed by the error in error_ctx. */
+typedef struct {
+  yaml_event_t *events;
+  size_t count;
+  size_t capa;
+  size_t next;
+  int failed;
+  s_error_context error_ctx;
+} s_event_buffer;
+
+/* The loader takes its events straight from a parser or the JSON reader,
+ * or from a buffer filled earlier */
+typedef struct {
+  yaml_parser_t *parser;
+  s_json_reader *json;
+  s_event_buffer *buffer;
+} s_event_source;
+
+#define EVENT_BUFFER_INITIAL_SIZE 256
+#define PARALLEL_PARSE_MIN_SIZE 65536
+
+/* Check the loader options passed in from R. The handlers in
+ * options->s_handlers are sanitized and need protecting by the caller. The
+ * prototype is used as is. */
+static void Ryaml_get_load_options(
+  s_load_options *options,
+  SEXP s_as_named_list,
+  SEXP s_handlers,
+  SEXP s_eval_expr,
+  SEXP s_eval_warning,
+  SEXP s_merge_precedence,
+  SEXP s_merge_warning,
+  SEXP s_timestamps,
+  SEXP s_simplify,
+  SEXP s_limits,
+  SEXP s_schema,
+  SEXP s_prototype)
+{
+  const char *merge_precedence = NULL, *simplify = NULL, *schema = NULL;
+
+  if (!isLogical(s_as_named_list) || length(s_as_named_list) != 1) {
+    error("as.named.list argument must be a logical vector of length 1");
+    return;
+  }
+
+  if (!isLogical(s_eval_expr) || length(s_eval_expr) != 1) {
+    error("eval.expr argument must be a logical vector of length 1");
+    return;
+  }
+
+  if (!isLogical(s_eval_warning) || length(s_eval_warning) != 1) {
+    error("eval.warning argument must be a logical vector of length 1");
+    return;
+  }
+
+  if (!isString(s_merge_precedence) || length(s_merge_precedence) != 1) {
+    error("merge.precedence argument must be a character vector of length 1");
+    return;
+  }
+  else {
+    merge_precedence = CHAR(STRING_ELT(s_merge_precedence, 0));
+    if (strcmp(merge_precedence, "order") == 0) {
+      options->merge_override = 0;
+    }
+    else if (strcmp(merge_precedence, "override") == 0) {
+      options->merge_override = 1;
+    }
+    else {
+      error("merge.precedence must be either 'ordered' or 'override'");
+      return;
+    }
+  }
+
+  if (!isLogical(s_merge_warning) || length(s_merge_warning) != 1) {
+    error("merge.warning argument must be a logical vector of length 1");
+    return;
+  }
+
+  if (!isLogical(s_timestamps) || length(s_timestamps) != 1) {
+    error("timestamps argument must be a logical vector of length 1");
+    return;
+  }
+
+  if (!isString(s_simplify) || length(s_simplify) != 1) {
+    error("simplify argument must be a character vector of length 1");
+    return;
+  }
+  simplify = CHAR(STRING_ELT(s_simplify, 0));
+  if (strcmp(simplify, "data.frame") == 0) {
+    options->frames = 1;
+  }
+  else if (strcmp(simplify, "none") == 0) {
+    options->frames = 0;
+  }
+  else {
+    error("simplify must be either 'none' or 'data.frame'");
+    return;
+  }
+
+  if (!isString(s_schema) || length(s_schema) != 1) {
+    error("schema argument must be a character vector of length 1");
+    return;
+  }
+  schema = CHAR(STRING_ELT(s_schema, 0));
+  if (strcmp(schema, "yaml1.1") == 0) {
+    options->schema = SCHEMA_YAML11;
+  }
+  else if (strcmp(schema, "core") == 0) {
+    options->schema = SCHEMA_CORE;
+  }
+  else if (strcmp(schema, "json") == 0) {
+    options->schema = SCHEMA_JSON;
+  }
+  else if (strcmp(schema, "failsafe") == 0) {
+    options->schema = SCHEMA_FAILSAFE;
+  }
+  else {
+    error("schema must be one of 'yaml1.1', 'core', 'json' or 'failsafe'");
+    return;
+  }
+
+  if (!is_valid_prototype(s_prototype)) {
+    error("prototype must be NULL, a logical, integer, numeric or character vector, or a list of prototypes");
+    return;
+  }
+
+  get_limits(s_limits, &options->limits);
+
+  options->as_named_list = LOGICAL(s_as_named_list)[0];
+  options->eval_expr = LOGICAL(s_eval_expr)[0];
+  options->eval_warning = LOGICAL(s_eval_warning)[0];
+  options->merge_warning = LOGICAL(s_merge_warning)[0];
+  options->timestamps = LOGICAL(s_timestamps)[0];
+  options->s_handlers = Ryaml_sanitize_handlers(s_handlers);
+  options->s_prototype = s_prototype;
+
+  /* Custom sequence and map handlers need to see every list, and keys that
+   * aren't coerced to names can't be column names */
+  if (!options->as_named_list ||
+      Ryaml_find_handler(options->s_handlers, "seq") != R_NilValue ||
+      Ryaml_find_handler(options->s_handlers, "map") != R_NilValue) {
+    options->frames = 0;
+  }
+}
+
+/* Describe why the parser failed. Doesn't call into R. */
+static void Ryaml_set_parser_error(yaml_parser_t *parser, s_error_context *error_ctx)
+{
+  switch (parser->error) {
+    case YAML_MEMORY_ERROR:
+      Ryaml_set_error_msg(error_ctx, "Memory error: Not enough memory for parsing");
+      break;
+
+    case YAML_READER_ERROR:
+      if (parser->problem_value != -1) {
+        Ryaml_set_error_msg(error_ctx, "Reader error: %s: #%X at %d", parser->problem,
+          parser->problem_value, (int)parser->problem_offset);
+      }
+      else {
+        Ryaml_set_error_msg(error_ctx, "Reader error: %s at %d", parser->problem,
+          (int)parser->problem_offset);
+      }
+      break;
+
+    case YAML_SCANNER_ERROR:
+      if (parser->context) {
+        Ryaml_set_error_msg(error_ctx, "Scanner error: %s at line %d, column %d "
+          "%s at line %d, column %d\n", parser->context,
+          (int)parser->context_mark.line+1,
+          (int)parser->context_mark.column+1,
+          parser->problem, (int)parser->problem_mark.line+1,
+          (int)parser->problem_mark.column+1);
+      }
+      else {
+        Ryaml_set_error_msg(error_ctx, "Scanner error: %s at line %d, column %d",
+          parser->problem, (int)parser->problem_mark.line+1,
+          (int)parser->problem_mark.column+1);
+      }
+      break;
+
+    case YAML_PARSER_ERROR:
+      if (parser->context) {
+        Ryaml_set_error_msg(error_ctx, "Parser error: %s at line %d, column %d "
+          "%s at line %d, column %d", parser->context,
+          (int)parser->context_mark.line+1,
+          (int)parser->context_mark.column+1,
+          parser->problem, (int)parser->problem_mark.line+1,
+          (int)parser->problem_mark.column+1);
+      }
+      else {
+        Ryaml_set_error_msg(error_ctx, "Parser error: %s at line %d, column %d",
+          parser->problem, (int)parser->problem_mark.line+1,
+          (int)parser->problem_mark.column+1);
+      }
+      break;
+
+    default:
+      /* Couldn't happen unless there is an undocumented/unhandled error
+       * from LibYAML. */
+      Ryaml_set_error_msg(error_ctx, "Internal error: unknown parser error");
+      break;
+  }
+}
+
+/* Get the next event from source. Returns 0 with the error set if there
+ * isn't one. */
+static int Ryaml_next_event(
+  s_event_source *source,
+  yaml_event_t *event,
+  s_error_context *error_ctx)
+{
+  s_event_buffer *buffer = source->buffer;
+
+  if (source->parser != NULL) {
+    if (!yaml_parser_parse(source->parser, event)) {
+      Ryaml_set_parser_error(source->parser, error_ctx);
+      return 0;
+    }
+    return 1;
+  }
+
+  if (source->json != NULL) {
+    if (!Ryaml_json_reader_next(source->json, event)) {
+      Ryaml_set_error_msg(error_ctx, "JSON error: %s at line %d, column %d",
+        source->json->problem, (int)source->json->problem_mark.line+1,
+        (int)source->json->problem_mark.column+1);
+      return 0;
+    }
+    return 1;
+  }
+
+  if (buffer->next < buffer->count) {
+    /* The event is handed over, so the buffer mustn't delete it too */
+    *event = buffer->events[buffer->next];
+    memset(&buffer->events[buffer->next], 0, sizeof(yaml_event_t));
+    buffer->next++;
+    return 1;
+  }
+
+  memset(event, 0, sizeof(yaml_event_t));
+  if (buffer->failed) {
+    *error_ctx = buffer->error_ctx;
+  }
+  else {
+    Ryaml_set_error_msg(error_ctx, "Internal error: ran out of events");
+  }
+  return 0;
+}
+
+/* Turn the events of one document into an R object. Returns R_NilValue
+ * with the error set in error_ctx on failure. */
+static SEXP Ryaml_load_events(
+  s_event_source *source,
+  s_load_options *options,
+  s_error_context *error_ctx)
+{
+  SEXP s_retval = NULL, s_stack_head = NULL, s_stack_tail = NULL,
+       s_aliases_head = NULL, s_aliases_tail = NULL, s_anchor = NULL,
+       s_prototype = NULL, s_obj = NULL;
+  yaml_event_t event;
+  s_structure *structures = NULL, *parent = NULL;
+  long nodes = 0;
+  int done = 0, err = 0, depth = 0, structures_size = 0;
+
+  structures_size = STRUCTURE_STACK_INITIAL_SIZE;
+  structures = (s_structure *)R_alloc(structures_size, sizeof(s_structure));
+  options->limits.merge_keys_used = 0;
+
+  PROTECT(s_stack_head = s_stack_tail = list1(Ryaml_Sentinel));
+  PROTECT(s_aliases_head = s_aliases_tail = list1(Ryaml_Sentinel));
+  error_ctx->msg[0] = 0;
+  while (!done) {
+    if (Ryaml_next_event(source, &event, error_ctx)) {
+      err = check_limits(&event, &options->limits, depth, &nodes, error_ctx);
+      if (err) {
+        s_retval = R_NilValue;
+        done = 1;
+        yaml_event_delete(&event);
+        continue;
+      }
+
+      /* Anything but a map that goes straight into a sequence whose
+       * elements are being collected into columns ends the collecting */
+      parent = depth > 0 ? &structures[depth - 1] : NULL;
+      if (parent != NULL && !parent->is_map && parent->frame == FRAME_ACTIVE &&
+          (event.type == YAML_SCALAR_EVENT || event.type == YAML_ALIAS_EVENT ||
+           event.type == YAML_SEQUENCE_START_EVENT)) {
+        flush_frame_rows(parent, &s_stack_tail);
+      }
+
+      /* The prototype of the node this event starts, if there is one.
+       * Nodes in a typed sequence have to be scalars. */
+      s_prototype = R_NilValue;
+      if (options->s_prototype != R_NilValue) {
+        s_prototype = parent == NULL ? options->s_prototype : child_prototype(parent, s_stack_tail);
+        if (parent != NULL && parent->typed &&
+            (event.type == YAML_SEQUENCE_START_EVENT || event.type == YAML_MAPPING_START_EVENT)) {
+          err = set_prototype_error(&event, s_prototype, error_ctx);
+        }
+        else {
+          err = check_prototype(&event, s_prototype, error_ctx);
+        }
+        if (err) {
+          s_retval = R_NilValue;
+          done = 1;
+          yaml_event_delete(&event);
+          continue;
+        }
+      }
+
+      switch (event.type) {
+        case YAML_NO_EVENT:
+        case YAML_STREAM_START_EVENT:
+        case YAML_DOCUMENT_START_EVENT:
+        case YAML_DOCUMENT_END_EVENT:
+          break;
+
+        case YAML_ALIAS_EVENT:
+#if DEBUG
+          Rprintf("ALIAS: %s\n", event.data.alias.anchor);
+#endif
+          if (parent != NULL && parent->typed) {
+            err = append_typed_alias(parent, &event, s_aliases_head, error_ctx);
+          }
+          else {
+            handle_alias(&event, &s_stack_tail, s_aliases_head);
+            if (is_atomic_prototype(s_prototype) && TYPEOF(CAR(s_stack_tail)) != TYPEOF(s_prototype)) {
+              err = set_prototype_error(&event, s_prototype, error_ctx);
+            }
+          }
+          break;
+
+        case YAML_SCALAR_EVENT:
+#if DEBUG
+          Rprintf("SCALAR: %s (%s) [%s]\n", event.data.scalar.value, event.data.scalar.tag, event.data.scalar.anchor);
+#endif
+          s_obj = NULL;
+          if (parent != NULL && parent->typed) {
+            err = append_typed_scalar(parent, &event, options->schema, &s_obj, error_ctx);
+          }
+          else if (s_prototype != R_NilValue) {
+            err = handle_typed_scalar(&event, &s_stack_tail, s_prototype, options->schema, error_ctx);
+          }
+          else {
+            err = handle_scalar(&event, &s_stack_tail, options->s_handlers, options->eval_expr, options->eval_warning, options->timestamps, options->schema, error_ctx);
+          }
+          if (!err && event.data.scalar.anchor != NULL) {
+            PROTECT(s_obj = s_obj != NULL ? s_obj : CAR(s_stack_tail));
+            PROTECT(s_anchor = mkCharCE((char *)event.data.scalar.anchor, CE_UTF8));
+            possibly_record_alias(s_anchor, &s_aliases_tail, s_obj);
+            UNPROTECT(2);
+          }
+          break;
+
+        case YAML_SEQUENCE_START_EVENT:
+#if DEBUG
+          Rprintf("SEQUENCE START: (%s) [%s]\n", event.data.sequence_start.tag, event.data.sequence_start.anchor);
+#endif
+          handle_structure_start(&event, &s_stack_tail, 0);
+          push_structure(&structures, &depth, &structures_size, s_stack_tail, 0);
+          structures[depth - 1].s_prototype = s_prototype;
+          if (is_atomic_prototype(s_prototype)) {
+            start_typed_sequence(&structures[depth - 1], s_prototype);
+          }
+          break;
+
+        case YAML_SEQUENCE_END_EVENT:
+#if DEBUG
+          Rprintf("SEQUENCE END\n");
+#endif
+          depth--;
+          if (structures[depth].typed) {
+            finish_typed_sequence(&structures[depth], &s_stack_tail);
+          }
+          else if (structures[depth].frame == FRAME_ACTIVE) {
+            finish_frame(&structures[depth], &s_stack_tail);
+          }
+          else {
+            err = handle_sequence(&event, s_stack_head, &s_stack_tail, options->s_handlers, options->as_named_list, error_ctx);
+          }
+          if (!err) {
+            s_anchor = CADR(TAG(s_stack_tail));
+            possibly_record_alias(s_anchor, &s_aliases_tail, CAR(s_stack_tail));
+            SET_TAG(s_stack_tail, R_NilValue);
+          }
+          break;
+
+        case YAML_MAPPING_START_EVENT:
+#if DEBUG
+          Rprintf("MAPPING START: (%s) [%s]\n", event.data.mapping_start.tag, event.data.mapping_start.anchor);
+#endif
+          handle_structure_start(&event, &s_stack_tail, 1);
+          push_structure(&structures, &depth, &structures_size, s_stack_tail, 1);
+          structures[depth - 1].s_prototype = s_prototype;
+          break;
+
+        case YAML_MAPPING_END_EVENT:
+#if DEBUG
+          Rprintf("MAPPING END\n");
+#endif
+          depth--;
+          parent = depth > 0 ? &structures[depth - 1] : NULL;
+          if (options->frames && parent != NULL && !parent->is_map && parent->frame != FRAME_OFF) {
+            /* Only an untagged, unanchored sequence of maps can become a
+             * data.frame */
+            if (parent->frame == FRAME_UNKNOWN &&
+                (CDR(parent->s_start) != structures[depth].s_start ||
+                 CAR(TAG(parent->s_start)) != R_NilValue ||
+                 CADR(TAG(parent->s_start)) != R_NilValue)) {
+              parent->frame = FRAME_OFF;
+            }
+            else if (append_frame_row(parent, &structures[depth], &s_stack_tail)) {
+              break;
+            }
+            else {
+              flush_frame_rows(parent, &s_stack_tail);
+            }
+          }
+
+          err = handle_map(&event, s_stack_head, &s_stack_tail, options->s_handlers, options->as_named_list, options->merge_override, options->merge_warning, &options->limits, error_ctx);
+          if (!err) {
+            s_anchor = CADR(TAG(s_stack_tail));
+            possibly_record_alias(s_anchor, &s_aliases_tail, CAR(s_stack_tail));
+            SET_TAG(s_stack_tail, R_NilValue);
+          }
+
+          break;
+
+        case YAML_STREAM_END_EVENT:
+          if (CADR(s_stack_head) != Ryaml_Sentinel) {
+            s_retval = CADR(s_stack_head);
+          }
+          else {
+            s_retval = R_NilValue;
+          }
+
+          done = 1;
+          break;
+      }
+
+      if (err) {
+        s_retval = R_NilValue;
+        done = 1;
+      }
+      else if (depth > 0 &&
+               (event.type == YAML_SCALAR_EVENT || event.type == YAML_ALIAS_EVENT ||
+                event.type == YAML_SEQUENCE_END_EVENT || event.type == YAML_MAPPING_END_EVENT)) {
+        /* Maps need to know whether the next node is a key or a value */
+        structures[depth - 1].children++;
+      }
+    }
+    else {
+      s_retval = R_NilValue;
+      done = 1;
+    }
+
+    yaml_event_delete(&event);
+  }
+
+  UNPROTECT(2); /* s_stack_head, s_aliases_head */
+
+  return s_retval;
+}
+
+/* Run parser to the end of the stream, keeping the events in buffer. This
+ * runs on worker threads, so it only uses libyaml and the C library. */
+static void Ryaml_parse_into_buffer(yaml_parser_t *parser, s_event_buffer *buffer)
+{
+  yaml_event_t *events = NULL;
+  int done = 0;
+
+  while (!done) {
+    if (buffer->count == buffer->capa) {
+      events = (yaml_event_t *)realloc(buffer->events, sizeof(yaml_event_t) *
+          (buffer->capa == 0 ? EVENT_BUFFER_INITIAL_SIZE : buffer->capa * 2));
+      if (events == NULL) {
+        Ryaml_set_error_msg(&buffer->error_ctx, "Memory error: Not enough memory for parsing");
+        buffer->failed = 1;
+        break;
+      }
+      buffer->events = events;
+      buffer->capa = buffer->capa == 0 ? EVENT_BUFFER_INITIAL_SIZE : buffer->capa * 2;
+    }
+
+    if (!yaml_parser_parse(parser, &buffer->events[buffer->count])) {
+      Ryaml_set_parser_error(parser, &buffer->error_ctx);
+      buffer->failed = 1;
+      break;
+    }
+    done = buffer->events[buffer->count].type == YAML_STREAM_END_EVENT;
+    buffer->count++;
+  }
+}
+
+/* Parse a whole file into buffer, on a worker thread */
+static void Ryaml_parse_file(const char *path, s_event_buffer *buffer)
+{
+  yaml_parser_t parser;
+  FILE *file = NULL;
+
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    Ryaml_set_error_msg(&buffer->error_ctx, "Couldn't open file: %s", path);
+    buffer->failed = 1;
+    return;
+  }
+
+  yaml_parser_initialize(&parser);
+  yaml_parser_set_input_file(&parser, file);
+  Ryaml_parse_into_buffer(&parser, buffer);
+  yaml_parser_delete(&parser);
+  fclose(file);
+}
+
+static void Ryaml_free_event_buffer(s_event_buffer *buffer)
+{
+  size_t i = 0;
+
+  for (i = 0; i < buffer->count; i++) {
+    yaml_event_delete(&buffer->events[i]);
+  }
+  free(buffer->events);
+  memset(buffer, 0, sizeof(s_event_buffer));
+}
+
+/* Event buffers that are kept in an external pointer, so that they are
+ * freed even if an R error interrupts the loading */
+typedef struct {
+  s_event_buffer *buffers;
+  int count;
+} s_event_buffers;
+
+static void Ryaml_finalize_event_buffers(SEXP s_buffers)
+{
+  s_event_buffers *buffers = (s_event_buffers *)R_ExternalPtrAddr(s_buffers);
+  int i = 0;
+
+  if (buffers != NULL) {
+    for (i = 0; i < buffers->count; i++) {
+      Ryaml_free_event_buffer(&buffers->buffers[i]);
+    }
+    free(buffers->buffers);
+    free(buffers);
+    R_ClearExternalPtr(s_buffers);
+  }
+}
+
+/* Allocate count empty event buffers, returning the (unprotected) external
+ * pointer that owns them */
+static SEXP Ryaml_alloc_event_buffers(int count, s_event_buffers **result)
+{
+  SEXP s_buffers = NULL;
+  s_event_buffers *buffers = NULL;
+
+  buffers = (s_event_buffers *)calloc(1, sizeof(s_event_buffers));
+  if (buffers != NULL) {
+    buffers->buffers = (s_event_buffer *)calloc(count, sizeof(s_event_buffer));
+  }
+  if (buffers == NULL || buffers->buffers == NULL) {
+    free(buffers);
+    error("couldn't allocate memory for parsing");
+    return R_NilValue;
+  }
+  buffers->count = count;
+
+  PROTECT(s_buffers = R_MakeExternalPtr(buffers, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(s_buffers, Ryaml_finalize_event_buffers, TRUE);
+  UNPROTECT(1);
+
+  *result = buffers;
+  return s_buffers;
+}
+
+/* Check the threads argument passed in from R */
+static int Ryaml_get_threads(SEXP s_threads)
+{
+  int threads = 0;
+
+  if (isNumeric(s_threads) && length(s_threads) == 1) {
+    s_threads = coerceVector(s_threads, INTSXP);
+    threads = INTEGER(s_threads)[0];
+  }
+  if (threads == NA_INTEGER || threads < 1) {
+    error("threads argument must be a positive number");
+    return 1;
+  }
+#ifndef _OPENMP
+  threads = 1;
+#endif
+
+  return threads;
+}
+
+/* Whether a line of the document can start a new entry of a root sequence
+ * or map. Only "- " and plain keys qualify, so that a chunk never starts
+ * with a quoted or complex key, an indicator or a document marker. */
+static int Ryaml_is_entry_line(const char *line, const char *end, int is_map)
+{
+  char c = line < end ? *line : 0;
+
+  if (!is_map) {
+    return c == '-' && (line + 1 == end || line[1] == ' ' || line[1] == '\t' ||
+        line[1] == '\r' || line[1] == '\n');
+  }
+  return c != 0 && strchr(" \t\r\n#-?:%[]{},'\"!&*|>@`.", c) == NULL;
+}
+
+/* Find where to split a document whose root is a block sequence or map into
+ * count chunks of about the same size, at the starts of root entries.
+ * offsets gets the start of each chunk and the end of the last one. Returns
+ * the number of chunks, or 0 if the document can't be split. */
+static int Ryaml_split_document(const char *string, size_t len, int count, size_t *offsets)
+{
+  const char *end = string + len, *line = string, *next = NULL, *p = NULL;
+  size_t target = 0, first = 0;
+  int is_map = 0, chunks = 0, i = 0;
+
+  /* Skip blank lines, comments, directives and a "---" start marker to find
+   * the first line of the root node */
+  while (line < end) {
+    for (p = line; p < end && (*p == ' ' || *p == '\t' || *p == '\r'); p++);
+    if (p < end && *p != '\n' && *p != '#' && *p != '%' &&
+        !(p == line && end - p >= 3 && strncmp(p, "---", 3) == 0 &&
+          (end - p == 3 || strchr(" \t\r\n", p[3]) != NULL))) {
+      break;
+    }
+    next = memchr(line, '\n', end - line);
+    line = next == NULL ? end : next + 1;
+  }
+  if (Ryaml_is_entry_line(line, end, 0)) {
+    is_map = 0;
+  }
+  else if (Ryaml_is_entry_line(line, end, 1)) {
+    is_map = 1;
+  }
+  else {
+    return 0;
+  }
+  first = line - string;
+
+  offsets[chunks++] = 0;
+  for (i = 1; i < count; i++) {
+    target = (size_t)((double)len * i / count);
+    if (target <= offsets[chunks - 1]) {
+      target = offsets[chunks - 1] + 1;
+    }
+    if (target <= first) {
+      target = first + 1;
+    }
+
+    /* Move on to the next line that starts a root entry */
+    line = string + target;
+    do {
+      next = line < end ? memchr(line, '\n', end - line) : NULL;
+      line = next == NULL ? end : next + 1;
+    } while (line < end && !Ryaml_is_entry_line(line, end, is_map));
+    if (line >= end) {
+      break;
+    }
+    offsets[chunks++] = line - string;
+  }
+  offsets[chunks] = len;
+
+  return chunks > 1 ? chunks : 0;
+}
+
+/* Check that each chunk held one document whose root is a block collection
+ * of the same kind, with no tag or anchor except in the first chunk, and
+ * join the entries of the chunks into one stream of events in result.
+ * lines is the number of lines before each chunk, which is added to the
+ * line numbers of its events. Returns 0, changing nothing, if the chunks
+ * don't fit together. */
+static int Ryaml_splice_chunks(
+  s_event_buffer *chunks,
+  int count,
+  size_t *lines,
+  s_event_buffer *result)
+{
+  s_event_buffer *chunk = NULL;
+  yaml_event_t *root = NULL, *event = NULL;
+  yaml_event_type_t root_type = YAML_NO_EVENT;
+  size_t total = 0, first = 0, last = 0, j = 0;
+  int i = 0;
+
+  for (i = 0; i < count; i++) {
+    chunk = &chunks[i];
+    if (chunk->failed || chunk->count < 6 ||
+        chunk->events[0].type != YAML_STREAM_START_EVENT ||
+        chunk->events[1].type != YAML_DOCUMENT_START_EVENT ||
+        chunk->events[chunk->count - 2].type != YAML_DOCUMENT_END_EVENT ||
+        chunk->events[chunk->count - 1].type != YAML_STREAM_END_EVENT) {
+      return 0;
+    }
+
+    root = &chunk->events[2];
+    if (i == 0) {
+      root_type = root->type;
+    }
+    if (root->type != root_type) {
+      return 0;
+    }
+    if (root_type == YAML_SEQUENCE_START_EVENT) {
+      if (root->data.sequence_start.style != YAML_BLOCK_SEQUENCE_STYLE ||
+          chunk->events[chunk->count - 3].type != YAML_SEQUENCE_END_EVENT ||
+          (i > 0 && (root->data.sequence_start.anchor != NULL ||
+                     root->data.sequence_start.tag != NULL))) {
+        return 0;
+      }
+    }
+    else if (root_type == YAML_MAPPING_START_EVENT) {
+      if (root->data.mapping_start.style != YAML_BLOCK_MAPPING_STYLE ||
+          chunk->events[chunk->count - 3].type != YAML_MAPPING_END_EVENT ||
+          (i > 0 && (root->data.mapping_start.anchor != NULL ||
+                     root->data.mapping_start.tag != NULL))) {
+        return 0;
+      }
+    }
+    else {
+      return 0;
+    }
+
+    /* Only the first chunk can start the document explicitly, and only the
+     * last one can end it */
+    if ((i > 0 && !chunk->events[1].data.document_start.implicit) ||
+        (i < count - 1 && !chunk->events[chunk->count - 2].data.document_end.implicit)) {
+      return 0;
+    }
+
+    /* A second document would mean the split was in the wrong place */
+    for (j = 3; j < chunk->count - 3; j++) {
+      if (chunk->events[j].type == YAML_DOCUMENT_START_EVENT) {
+        return 0;
+      }
+    }
+
+    total += chunk->count;
+  }
+
+  result->events = (yaml_event_t *)malloc(sizeof(yaml_event_t) * total);
+  if (result->events == NULL) {
+    return 0;
+  }
+  result->capa = total;
+  result->count = 0;
+
+  /* The stream, document and root starts come from the first chunk, and
+   * their ends from the last one */
+  for (i = 0; i < count; i++) {
+    chunk = &chunks[i];
+    first = i == 0 ? 0 : 3;
+    last = i == count - 1 ? chunk->count : chunk->count - 3;
+    for (j = first; j < last; j++) {
+      event = &result->events[result->count++];
+      *event = chunk->events[j];
+      event->start_mark.line += lines[i];
+      event->end_mark.line += lines[i];
+      memset(&chunk->events[j], 0, sizeof(yaml_event_t));
+    }
+  }
+
+  return 1;
+}
+
+/* Try parsing a large document on several threads, by splitting it into
+ * chunks at root entries and parsing each chunk as a document of its own.
+ * Returns 0, leaving buffer empty, if the document can't be split or the
+ * chunks don't parse into pieces of one document; it is then parsed as a
+ * whole instead, which also reports any errors properly. */
+static int Ryaml_parse_parallel(
+  const char *string,
+  size_t len,
+  int threads,
+  s_event_buffer *buffer)
+{
+  s_event_buffer *chunks = NULL;
+  size_t *offsets = NULL, *lines = NULL;
+  int count = 0, i = 0, result = 0;
+
+  offsets = (size_t *)R_alloc(threads + 1, sizeof(size_t));
+  count = Ryaml_split_document(string, len, threads, offsets);
+  if (count == 0) {
+    return 0;
+  }
+
+  chunks = (s_event_buffer *)R_alloc(count, sizeof(s_event_buffer));
+  memset(chunks, 0, sizeof(s_event_buffer) * count);
+  lines = (size_t *)R_alloc(count, sizeof(size_t));
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+  for (i = 0; i < count; i++) {
+    yaml_parser_t parser;
+    const char *p = string + offsets[i], *end = string + offsets[i + 1];
+
+    yaml_parser_initialize(&parser);
+    yaml_parser_set_input_string(&parser, (const unsigned char *)p, end - p);
+    Ryaml_parse_into_buffer(&parser, &chunks[i]);
+    yaml_parser_delete(&parser);
+
+    lines[i] = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+      lines[i]++;
+      p++;
+    }
+  }
+
+  /* Make the line counts cumulative */
+  for (i = count - 1; i > 0; i--) {
+    lines[i] = lines[i - 1];
+  }
+  lines[0] = 0;
+  for (i = 1; i < count; i++) {
+    lines[i] += lines[i - 1];
+  }
+
+  result = Ryaml_splice_chunks(chunks, count, lines, buffer);
+  for (i = 0; i < count; i++) {
+    Ryaml_free_event_buffer(&chunks[i]);
+  }
+
+  return result;
+}
+
+SEXP Ryaml_unserialize_from_yaml(
+  SEXP s_string,
+  SEXP s_as_named_list,
+  SEXP s_handlers,
+  SEXP s_error_label,
+  SEXP s_eval_expr,
+  SEXP s_eval_warning,
+  SEXP s_merge_precedence,
+  SEXP s_merge_warning,
+  SEXP s_timestamps,
+  SEXP s_simplify,
+  SEXP s_limits,
+  SEXP s_threads,
+  SEXP s_schema,
+  SEXP s_prototype,
+  SEXP s_json)
+{
+  SEXP s_retval = NULL, s_buffers = NULL;
+  yaml_parser_t parser;
+  s_json_reader json_reader;
+  s_event_source source;
+  s_event_buffers *buffers = NULL;
+  s_load_options options;
+  s_error_context error_ctx;
+  const char *string = NULL, *error_label = NULL;
+  long len = 0;
+  int threads = 0, json = 0;
+
+  if (!isString(s_string) || length(s_string) != 1) {
+    error("string argument must be a character vector of length 1");
+    return R_NilValue;
+  }
+
+  if (s_error_label == R_NilValue) {
+    error_label = NULL;
+  }
+  else if (!isString(s_error_label) || length(s_error_label) != 1) {
+    error("error.label argument must be either NULL or a character vector of length 1");
+    return R_NilValue;
+  } else {
+    error_label = CHAR(STRING_ELT(s_error_label, 0));
+  }
+
+  Ryaml_get_load_options(&options, s_as_named_list, s_handlers, s_eval_expr,
+      s_eval_warning, s_merge_precedence, s_merge_warning, s_timestamps,
+      s_simplify, s_limits, s_schema, s_prototype);
+  PROTECT(options.s_handlers);
+  threads = Ryaml_get_threads(s_threads);
+
+  if (!isLogical(s_json) || length(s_json) != 1) {
+    error("json argument must be a logical vector of length 1");
+    return R_NilValue;
+  }
+  json = LOGICAL(s_json)[0];
+
+  string = CHAR(STRING_ELT(s_string, 0));
+  len = length(STRING_ELT(s_string, 0));
+
+  yaml_parser_initialize(&parser);
+  Ryaml_json_reader_initialize(&json_reader, string, len);
+  source.parser = &parser;
+  source.json = NULL;
+  source.buffer = NULL;
+
+  /* Limits are meant to stop the parser early on hostile input, so a
+   * document is only parsed ahead of time when there are none. Documents
+   * that are JSON are read by the JSON reader, unless json is FALSE. When
+   * it is NA, that is only done if the reader gives the same events as
+   * libyaml would. */
+  PROTECT(s_buffers = Ryaml_alloc_event_buffers(1, &buffers));
+  if (json == TRUE || (json == NA_LOGICAL && Ryaml_is_json(string, len))) {
+    source.parser = NULL;
+    source.json = &json_reader;
+  }
+  else if (threads > 1 && len >= PARALLEL_PARSE_MIN_SIZE &&
+      options.limits.depth < 0 && options.limits.nodes < 0 &&
+      options.limits.scalar_size < 0 && options.limits.merge_keys < 0 &&
+      Ryaml_parse_parallel(string, len, threads, &buffers->buffers[0])) {
+    source.parser = NULL;
+    source.buffer = &buffers->buffers[0];
+  }
+  else {
+    yaml_parser_set_input_string(&parser, (const unsigned char *)string, len);
+  }
+
+  s_retval = Ryaml_load_events(&source, &options, &error_ctx);
+  yaml_parser_delete(&parser);
+  Ryaml_json_reader_delete(&json_reader);
+  Ryaml_finalize_event_buffers(s_buffers);
+
+  if (error_ctx.msg[0] != 0) {
+    Ryaml_raise_error(&error_ctx, error_label);
+  }
+
+  UNPROTECT(2); /* options.s_handlers, s_buffers */
+
+  return s_retval;
+}
+
+SEXP Ryaml_unserialize_from_yaml_files(
+  SEXP s_files,
+  SEXP s_threads,
+  SEXP s_as_named_list,
+  SEXP s_handlers,
+  SEXP s_eval_expr,
+  SEXP s_eval_warning,
+  SEXP s_merge_precedence,
+  SEXP s_merge_warning,
+  SEXP s_timestamps,
+  SEXP s_simplify,
+  SEXP s_limits,
+  SEXP s_schema,
+  SEXP s_prototype)
+{
+  SEXP s_retval = NULL, s_buffers = NULL;
+  s_event_buffers *buffers = NULL;
+  s_event_source source;
+  s_load_options options;
+  s_error_context error_ctx;
+  const char **paths = NULL;
+  const char *path = NULL;
+  char *copy = NULL;
+  const void *vmax = NULL;
+  int count = 0, threads = 0, batch = 0, start = 0, end = 0, i = 0;
+
+  if (!isString(s_files)) {
+    error("files argument must be a character vector");
+    return R_NilValue;
+  }
+  count = length(s_files);
+  threads = Ryaml_get_threads(s_threads);
+
+  Ryaml_get_load_options(&options, s_as_named_list, s_handlers, s_eval_expr,
+      s_eval_warning, s_merge_precedence, s_merge_warning, s_timestamps,
+      s_simplify, s_limits, s_schema, s_prototype);
+  PROTECT(options.s_handlers);
+
+  /* File names are expanded here, because R_ExpandFileName isn't safe to
+   * call from the worker threads */
+  paths = (const char **)R_alloc(count, sizeof(const char *));
+  for (i = 0; i < count; i++) {
+    if (STRING_ELT(s_files, i) == NA_STRING) {
+      error("files argument must not contain NA");
+      return R_NilValue;
+    }
+    path = R_ExpandFileName(translateChar(STRING_ELT(s_files, i)));
+    copy = R_alloc(strlen(path) + 1, sizeof(char));
+    strcpy(copy, path);
+    paths[i] = copy;
+  }
+
+  /* Files are parsed a batch at a time, so that only the events of one
+   * batch are held in memory at once */
+  batch = threads * 64;
+  PROTECT(s_buffers = Ryaml_alloc_event_buffers(batch, &buffers));
+
+  PROTECT(s_retval = allocVector(VECSXP, count));
+  source.parser = NULL;
+  source.json = NULL;
+  for (start = 0; start < count; start += batch) {
+    end = start + batch < count ? start + batch : count;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) if (threads > 1) schedule(dynamic)
+#endif
+    for (i = start; i < end; i++) {
+      Ryaml_parse_file(paths[i], &buffers->buffers[i - start]);
+    }
+
+    for (i = start; i < end; i++) {
+      vmax = vmaxget();
+      source.buffer = &buffers->buffers[i - start];
+      SET_VECTOR_ELT(s_retval, i, Ryaml_load_events(&source, &options, &error_ctx));
+      vmaxset(vmax);
+
+      if (error_ctx.msg[0] != 0) {
+        Ryaml_finalize_event_buffers(s_buffers);
+        Ryaml_raise_error(&error_ctx, CHAR(STRING_ELT(s_files, i)));
+        return R_NilValue;
+      }
+    }
+
+    for (i = start; i < end; i++) {
+      Ryaml_free_event_buffer(&buffers->buffers[i - start]);
+    }
+  }
+  Ryaml_finalize_event_buffers(s_buffers);
+
+  UNPROTECT(3); /* options.s_handlers, s_buffers, s_retval */
+
+  return s_retval;
+}
+
+#define INDEX_READ_SIZE 65536
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* Turns the character offsets in libyaml's marks into byte offsets, by
+ * reading the same UTF-8 file alongside the parser. Offsets have to be
+ * asked for in increasing order. The bytes passed over are hashed with
+ * 64-bit FNV-1a, once for the current document and once for the current
+ * key, so that changes can be found when they are read back. */
+typedef struct {
+  FILE *file;
+  unsigned char buffer[INDEX_READ_SIZE];
+  size_t len;
+  size_t pos;
+  size_t chars;
+  size_t bytes;
+  uint64_t hash;
+  uint64_t key_hash;
+} s_offset_cursor;
+
+/* Returns 0 if the file isn't UTF-8 */
+static int Ryaml_init_offset_cursor(s_offset_cursor *cursor, FILE *file)
+{
+  cursor->file = file;
+  cursor->len = fread(cursor->buffer, 1, INDEX_READ_SIZE, file);
+  cursor->pos = cursor->chars = cursor->bytes = 0;
+  cursor->hash = cursor->key_hash = FNV_OFFSET_BASIS;
+
+  if (cursor->len >= 2 &&
+      ((cursor->buffer[0] == 0xFE && cursor->buffer[1] == 0xFF) ||
+       (cursor->buffer[0] == 0xFF && cursor->buffer[1] == 0xFE))) {
+    return 0;
+  }
+
+  /* libyaml doesn't count the byte order mark as a character */
+  if (cursor->len >= 3 && cursor->buffer[0] == 0xEF &&
+      cursor->buffer[1] == 0xBB && cursor->buffer[2] == 0xBF) {
+    cursor->pos = cursor->bytes = 3;
+  }
+
+  return 1;
+}
+
+static double Ryaml_byte_offset(s_offset_cursor *cursor, size_t index)
+{
+  unsigned char c = 0;
+
+  for (;;) {
+    if (cursor->pos == cursor->len) {
+      cursor->len = fread(cursor->buffer, 1, INDEX_READ_SIZE, cursor->file);
+      cursor->pos = 0;
+      if (cursor->len == 0) {
+        break;
+      }
+    }
+
+    /* Stop at the first byte of character number index */
+    c = cursor->buffer[cursor->pos];
+    if ((c & 0xC0) != 0x80) {
+      if (cursor->chars == index) {
+        break;
+      }
+      cursor->chars++;
+    }
+    cursor->hash = (cursor->hash ^ c) * FNV_PRIME;
+    cursor->key_hash = (cursor->key_hash ^ c) * FNV_PRIME;
+    cursor->pos++;
+    cursor->bytes++;
+  }
+
+  return (double)cursor->bytes;
+}
+
+typedef struct {
+  double start;
+  double end;
+  uint64_t hash;
+} s_index_range;
+
+/* Offsets of the documents and top-level keys found so far */
+typedef struct {
+  s_index_range *documents;
+  size_t documents_count;
+  size_t documents_capa;
+
+  s_index_range *keys;
+  char **key_names;
+  int *key_documents;
+  int *key_self_contained;
+  size_t keys_count;
+  size_t keys_capa;
+
+  /* Anchors defined in the current key's entry */
+  char **anchors;
+  size_t anchors_count;
+  size_t anchors_capa;
+} s_yaml_index;
+
+static void Ryaml_clear_index_anchors(s_yaml_index *index)
+{
+  size_t i = 0;
+
+  for (i = 0; i < index->anchors_count; i++) {
+    free(index->anchors[i]);
+  }
+  index->anchors_count = 0;
+}
+
+static int Ryaml_add_index_anchor(s_yaml_index *index, const yaml_char_t *anchor)
+{
+  char **anchors = NULL;
+
+  if (anchor == NULL) {
+    return 1;
+  }
+
+  if (index->anchors_count == index->anchors_capa) {
+    anchors = (char **)realloc(index->anchors, sizeof(char *) *
+        (index->anchors_capa == 0 ? 16 : index->anchors_capa * 2));
+    if (anchors == NULL) {
+      return 0;
+    }
+    index->anchors = anchors;
+    index->anchors_capa = index->anchors_capa == 0 ? 16 : index->anchors_capa * 2;
+  }
+  index->anchors[index->anchors_count] = strdup((const char *)anchor);
+
+  return index->anchors[index->anchors_count++] != NULL;
+}
+
+static int Ryaml_has_index_anchor(s_yaml_index *index, const yaml_char_t *anchor)
+{
+  size_t i = 0;
+
+  for (i = 0; i < index->anchors_count; i++) {
+    if (strcmp(index->anchors[i], (const char *)anchor) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int Ryaml_add_index_document(
+  s_yaml_index *index,
+  double start,
+  double end,
+  uint64_t hash)
+{
+  s_index_range *documents = NULL;
+
+  if (index->documents_count == index->documents_capa) {
+    documents = (s_index_range *)realloc(index->documents, sizeof(s_index_range) *
+        (index->documents_capa == 0 ? 16 : index->documents_capa * 2));
+    if (documents == NULL) {
+      return 0;
+    }
+    index->documents = documents;
+    index->documents_capa = index->documents_capa == 0 ? 16 : index->documents_capa * 2;
+  }
+  index->documents[index->documents_count].start = start;
+  index->documents[index->documents_count].end = end;
+  index->documents[index->documents_count].hash = hash;
+  index->documents_count++;
+
+  return 1;
+}
+
+/* The key's name is taken over by the index */
+static int Ryaml_add_index_key(
+  s_yaml_index *index,
+  char *name,
+  int document,
+  double start,
+  double end,
+  uint64_t hash,
+  int self_contained)
+{
+  size_t capa = 0, i = 0;
+  void *p[4];
+
+  if (index->keys_count == index->keys_capa) {
+    capa = index->keys_capa == 0 ? 64 : index->keys_capa * 2;
+    p[0] = realloc(index->keys, sizeof(s_index_range) * capa);
+    if (p[0] != NULL) index->keys = (s_index_range *)p[0];
+    p[1] = realloc(index->key_names, sizeof(char *) * capa);
+    if (p[1] != NULL) index->key_names = (char **)p[1];
+    p[2] = realloc(index->key_documents, sizeof(int) * capa);
+    if (p[2] != NULL) index->key_documents = (int *)p[2];
+    p[3] = realloc(index->key_self_contained, sizeof(int) * capa);
+    if (p[3] != NULL) index->key_self_contained = (int *)p[3];
+    for (i = 0; i < 4; i++) {
+      if (p[i] == NULL) {
+        free(name);
+        return 0;
+      }
+    }
+    index->keys_capa = capa;
+  }
+
+  i = index->keys_count++;
+  index->keys[i].start = start;
+  index->keys[i].end = end;
+  index->keys[i].hash = hash;
+  index->key_names[i] = name;
+  index->key_documents[i] = document;
+  index->key_self_contained[i] = self_contained;
+
+  return 1;
+}
+
+static void Ryaml_free_index(s_yaml_index *index)
+{
+  size_t i = 0;
+
+  Ryaml_clear_index_anchors(index);
+  free(index->anchors);
+  for (i = 0; i < index->keys_count; i++) {
+    free(index->key_names[i]);
+  }
+  free(index->key_names);
+  free(index->keys);
+  free(index->key_documents);
+  free(index->key_self_contained);
+  free(index->documents);
+}
+
+static const yaml_char_t *Ryaml_event_anchor(yaml_event_t *event)
+{
+  switch (event->type) {
+    case YAML_SCALAR_EVENT:
+      return event->data.scalar.anchor;
+    case YAML_SEQUENCE_START_EVENT:
+      return event->data.sequence_start.anchor;
+    case YAML_MAPPING_START_EVENT:
+      return event->data.mapping_start.anchor;
+    default:
+      return NULL;
+  }
+}
+
+/* Scan a file once, recording the byte offsets of its documents and, for
+ * documents whose root is an untagged block map, of each entry with a
+ * scalar key. An entry is self-contained if every alias in it refers to an
+ * anchor in the same entry, so that it can be loaded on its own. */
+static void Ryaml_build_index(
+  FILE *parser_file,
+  FILE *cursor_file,
+  s_yaml_index *index,
+  s_error_context *error_ctx)
+{
+  yaml_parser_t parser;
+  yaml_event_t event;
+  s_offset_cursor *cursor = NULL;
+  const yaml_char_t *anchor = NULL;
+  char *key_name = NULL;
+  double document_start = 0, document_end = 0, key_start = 0, key_end = 0;
+  int done = 0, failed = 0, depth = 0, documents = 0, indexable = 0,
+      has_directives = 0, nodes = 0, self_contained = 0, completed = 0;
+
+  cursor = (s_offset_cursor *)malloc(sizeof(s_offset_cursor));
+  if (cursor == NULL) {
+    Ryaml_set_error_msg(error_ctx, "Memory error: Not enough memory for indexing");
+    return;
+  }
+  if (!Ryaml_init_offset_cursor(cursor, cursor_file)) {
+    Ryaml_set_error_msg(error_ctx, "Only UTF-8 files can be indexed");
+    free(cursor);
+    return;
+  }
+
+  yaml_parser_initialize(&parser);
+  yaml_parser_set_input_file(&parser, parser_file);
+  while (!done && !failed) {
+    if (!yaml_parser_parse(&parser, &event)) {
+      Ryaml_set_parser_error(&parser, error_ctx);
+      break;
+    }
+
+    completed = 0;
+    switch (event.type) {
+      case YAML_STREAM_START_EVENT:
+        break;
+
+      case YAML_STREAM_END_EVENT:
+        done = 1;
+        break;
+
+      case YAML_DOCUMENT_START_EVENT:
+        documents++;
+        document_start = Ryaml_byte_offset(cursor, event.start_mark.index);
+        cursor->hash = FNV_OFFSET_BASIS;
+        has_directives = event.data.document_start.tag_directives.start !=
+          event.data.document_start.tag_directives.end;
+        depth = 0;
+        indexable = 0;
+        break;
+
+      case YAML_DOCUMENT_END_EVENT:
+        document_end = Ryaml_byte_offset(cursor, event.end_mark.index);
+        failed = !Ryaml_add_index_document(index, document_start,
+            document_end, cursor->hash);
+        break;
+
+      case YAML_MAPPING_START_EVENT:
+        if (depth == 0) {
+          /* Entries of a tagged map or of a document with tag directives
+           * can't be loaded without the rest of the document */
+          indexable = event.data.mapping_start.style == YAML_BLOCK_MAPPING_STYLE &&
+            event.data.mapping_start.tag == NULL && !has_directives;
+          nodes = 0;
+          depth++;
+          break;
+        }
+        /* fall through */
+
+      case YAML_SEQUENCE_START_EVENT:
+      case YAML_SCALAR_EVENT:
+      case YAML_ALIAS_EVENT:
+        if (depth == 0 || !indexable) {
+          if (event.type == YAML_SEQUENCE_START_EVENT ||
+              event.type == YAML_MAPPING_START_EVENT) {
+            depth++;
+          }
+          break;
+        }
+
+        if (depth == 1 && nodes == 0) {
+          /* Start of an entry */
+          key_start = Ryaml_byte_offset(cursor, event.start_mark.index);
+          cursor->key_hash = FNV_OFFSET_BASIS;
+          Ryaml_clear_index_anchors(index);
+          self_contained = 1;
+          free(key_name);
+          key_name = NULL;
+          if (event.type == YAML_SCALAR_EVENT) {
+            key_name = strdup((const char *)event.data.scalar.value);
+            failed = key_name == NULL;
+          }
+        }
+
+        if (event.type == YAML_ALIAS_EVENT) {
+          if (!Ryaml_has_index_anchor(index, event.data.alias.anchor)) {
+            self_contained = 0;
+          }
+        }
+        else {
+          anchor = Ryaml_event_anchor(&event);
+          if (!Ryaml_add_index_anchor(index, anchor)) {
+            failed = 1;
+          }
+        }
+
+        if (event.type == YAML_SEQUENCE_START_EVENT ||
+            event.type == YAML_MAPPING_START_EVENT) {
+          depth++;
+        }
+        else {
+          completed = depth == 1;
+        }
+        break;
+
+      case YAML_SEQUENCE_END_EVENT:
+      case YAML_MAPPING_END_EVENT:
+        depth--;
+        completed = indexable && depth == 1;
+        break;
+
+      default:
+        break;
+    }
+
+    if (completed && ++nodes == 2) {
+      /* End of an entry */
+      if (key_name != NULL) {
+        key_end = Ryaml_byte_offset(cursor, event.end_mark.index);
+        failed = !Ryaml_add_index_key(index, key_name, documents, key_start,
+            key_end, cursor->key_hash, self_contained);
+        key_name = NULL;
       }
+      nodes = 0;
     }
-    error("%s", Ryaml_error_msg);
+
+    yaml_event_delete(&event);
   }
 
-  UNPROTECT(3); /* s_stack_head, s_aliases_head, s_handlers */
+  if (failed) {
+    Ryaml_set_error_msg(error_ctx, "Memory error: Not enough memory for indexing");
+  }
+
+  free(key_name);
+  yaml_parser_delete(&parser);
+  free(cursor);
+}
+
+static void Ryaml_finalize_index(SEXP s_index)
+{
+  s_yaml_index *index = (s_yaml_index *)R_ExternalPtrAddr(s_index);
+
+  if (index != NULL) {
+    Ryaml_free_index(index);
+    free(index);
+    R_ClearExternalPtr(s_index);
+  }
+}
+
+static SEXP Ryaml_index_offsets(s_index_range *ranges, size_t count, int end)
+{
+  SEXP s_offsets = NULL;
+  size_t i = 0;
+
+  s_offsets = allocVector(REALSXP, count);
+  for (i = 0; i < count; i++) {
+    REAL(s_offsets)[i] = end ? ranges[i].end : ranges[i].start;
+  }
+
+  return s_offsets;
+}
+
+/* Hashes are returned as hexadecimal strings, since R has no 64-bit
+ * integers */
+static SEXP Ryaml_format_hash(uint64_t hash)
+{
+  char buf[17];
+  int j = 0;
+
+  for (j = 15; j >= 0; j--) {
+    buf[j] = "0123456789abcdef"[hash & 0xF];
+    hash >>= 4;
+  }
+  buf[16] = 0;
+
+  return mkChar(buf);
+}
+
+static SEXP Ryaml_index_hashes(s_index_range *ranges, size_t count)
+{
+  SEXP s_hashes = NULL;
+  size_t i = 0;
+
+  PROTECT(s_hashes = allocVector(STRSXP, count));
+  for (i = 0; i < count; i++) {
+    SET_STRING_ELT(s_hashes, i, Ryaml_format_hash(ranges[i].hash));
+  }
+  UNPROTECT(1);
+
+  return s_hashes;
+}
+
+/* Returns the hash of a raw vector, computed the same way as the hashes in
+ * an index, so that bytes read back from a file can be checked */
+SEXP Ryaml_hash_bytes(SEXP s_bytes)
+{
+  SEXP s_hash = NULL, s_retval = NULL;
+  uint64_t hash = FNV_OFFSET_BASIS;
+  R_xlen_t i = 0;
+
+  if (TYPEOF(s_bytes) != RAWSXP) {
+    error("bytes argument must be a raw vector");
+    return R_NilValue;
+  }
+
+  for (i = 0; i < XLENGTH(s_bytes); i++) {
+    hash = (hash ^ RAW(s_bytes)[i]) * FNV_PRIME;
+  }
+
+  PROTECT(s_hash = Ryaml_format_hash(hash));
+  s_retval = ScalarString(s_hash);
+  UNPROTECT(1); /* s_hash */
+
+  return s_retval;
+}
+
+/* Returns the byte offsets of the documents and top-level keys in a file,
+ * as list(documents = list(start, end, hash), keys = list(document, key, start,
+ * end, hash, self.contained)) with 0-based starts and exclusive ends */
+SEXP Ryaml_index_yaml(SEXP s_file)
+{
+  SEXP s_retval = NULL, s_index = NULL, s_documents = NULL, s_keys = NULL,
+       s_names = NULL, s_vec = NULL;
+  s_yaml_index *index = NULL;
+  s_error_context error_ctx;
+  FILE *parser_file = NULL, *cursor_file = NULL;
+  const char *path = NULL;
+  size_t i = 0;
+
+  if (!isString(s_file) || length(s_file) != 1 || STRING_ELT(s_file, 0) == NA_STRING) {
+    error("file argument must be a character vector of length 1");
+    return R_NilValue;
+  }
+  path = R_ExpandFileName(translateChar(STRING_ELT(s_file, 0)));
+
+  /* The index is kept in an external pointer, so that it is freed even if
+   * an R error interrupts building the result */
+  index = (s_yaml_index *)calloc(1, sizeof(s_yaml_index));
+  if (index == NULL) {
+    error("couldn't allocate memory for indexing");
+    return R_NilValue;
+  }
+  PROTECT(s_index = R_MakeExternalPtr(index, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(s_index, Ryaml_finalize_index, TRUE);
+
+  /* The file is read twice side by side: once by the parser and once to
+   * turn the parser's character offsets into byte offsets */
+  parser_file = fopen(path, "rb");
+  cursor_file = parser_file == NULL ? NULL : fopen(path, "rb");
+  if (cursor_file == NULL) {
+    if (parser_file != NULL) {
+      fclose(parser_file);
+    }
+    error("Couldn't open file: %s", path);
+    return R_NilValue;
+  }
+
+  error_ctx.msg[0] = 0;
+  error_ctx.truncated = 0;
+  Ryaml_build_index(parser_file, cursor_file, index, &error_ctx);
+  fclose(parser_file);
+  fclose(cursor_file);
+
+  if (error_ctx.msg[0] != 0) {
+    Ryaml_finalize_index(s_index);
+    Ryaml_raise_error(&error_ctx, path);
+    return R_NilValue;
+  }
+
+  PROTECT(s_documents = allocVector(VECSXP, 3));
+  SET_VECTOR_ELT(s_documents, 0, Ryaml_index_offsets(index->documents, index->documents_count, 0));
+  SET_VECTOR_ELT(s_documents, 1, Ryaml_index_offsets(index->documents, index->documents_count, 1));
+  SET_VECTOR_ELT(s_documents, 2, Ryaml_index_hashes(index->documents, index->documents_count));
+  PROTECT(s_names = allocVector(STRSXP, 3));
+  SET_STRING_ELT(s_names, 0, mkChar("start"));
+  SET_STRING_ELT(s_names, 1, mkChar("end"));
+  SET_STRING_ELT(s_names, 2, mkChar("hash"));
+  setAttrib(s_documents, R_NamesSymbol, s_names);
+  UNPROTECT(1);
+
+  PROTECT(s_keys = allocVector(VECSXP, 6));
+  s_vec = allocVector(INTSXP, index->keys_count);
+  SET_VECTOR_ELT(s_keys, 0, s_vec);
+  for (i = 0; i < index->keys_count; i++) {
+    INTEGER(s_vec)[i] = index->key_documents[i];
+  }
+  s_vec = allocVector(STRSXP, index->keys_count);
+  SET_VECTOR_ELT(s_keys, 1, s_vec);
+  for (i = 0; i < index->keys_count; i++) {
+    SET_STRING_ELT(s_vec, i, mkCharCE(index->key_names[i], CE_UTF8));
+  }
+  SET_VECTOR_ELT(s_keys, 2, Ryaml_index_offsets(index->keys, index->keys_count, 0));
+  SET_VECTOR_ELT(s_keys, 3, Ryaml_index_offsets(index->keys, index->keys_count, 1));
+  SET_VECTOR_ELT(s_keys, 4, Ryaml_index_hashes(index->keys, index->keys_count));
+  s_vec = allocVector(LGLSXP, index->keys_count);
+  SET_VECTOR_ELT(s_keys, 5, s_vec);
+  for (i = 0; i < index->keys_count; i++) {
+    LOGICAL(s_vec)[i] = index->key_self_contained[i];
+  }
+  PROTECT(s_names = allocVector(STRSXP, 6));
+  SET_STRING_ELT(s_names, 0, mkChar("document"));
+  SET_STRING_ELT(s_names, 1, mkChar("key"));
+  SET_STRING_ELT(s_names, 2, mkChar("start"));
+  SET_STRING_ELT(s_names, 3, mkChar("end"));
+  SET_STRING_ELT(s_names, 4, mkChar("hash"));
+  SET_STRING_ELT(s_names, 5, mkChar("self.contained"));
+  setAttrib(s_keys, R_NamesSymbol, s_names);
+  UNPROTECT(1);
+
+  PROTECT(s_retval = allocVector(VECSXP, 2));
+  SET_VECTOR_ELT(s_retval, 0, s_documents);
+  SET_VECTOR_ELT(s_retval, 1, s_keys);
+  PROTECT(s_names = allocVector(STRSXP, 2));
+  SET_STRING_ELT(s_names, 0, mkChar("documents"));
+  SET_STRING_ELT(s_names, 1, mkChar("keys"));
+  setAttrib(s_retval, R_NamesSymbol, s_names);
+  UNPROTECT(1);
+
+  Ryaml_finalize_index(s_index);
+  UNPROTECT(4);
 
   return s_retval;
 }
@@ -0,0 +1,159 @@
+#include "r_ext.h"
+
+/* Implicit tags for plain scalars under the schemas of YAML 1.2
+ * (http://yaml.org/spec/1.2.2/#103-core-schema). The YAML 1.1 schema,
+ * with R's extensions, is the re2c automaton in implicit.re. The tags
+ * returned are the same names that automaton uses, so that handlers and
+ * the default conversions work with every schema. */
+
+static int Ryaml_is_word(const char *str, size_t len, const char *word)
+{
+  return strlen(word) == len && memcmp(str, word, len) == 0;
+}
+
+static int Ryaml_is_one_of(const char *str, size_t len, const char *a, const char *b, const char *c)
+{
+  return Ryaml_is_word(str, len, a) || Ryaml_is_word(str, len, b) ||
+    (c != NULL && Ryaml_is_word(str, len, c));
+}
+
+/* Skips the digits of the given base at the start of str and returns how
+ * many there were */
+static size_t Ryaml_skip_digits(const char **str, const char *end, int base)
+{
+  const char *start = *str;
+  char c = 0;
+
+  for (; *str < end; (*str)++) {
+    c = **str;
+    if (!((c >= '0' && c <= '9' && c - '0' < base) ||
+          (base == 16 && ((c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))))) {
+      break;
+    }
+  }
+
+  return *str - start;
+}
+
+/* Matches the exponent of a float, if any, and returns 0 if it is
+ * malformed */
+static int Ryaml_skip_exponent(const char **str, const char *end)
+{
+  if (*str < end && (**str == 'e' || **str == 'E')) {
+    (*str)++;
+    if (*str < end && (**str == '-' || **str == '+')) {
+      (*str)++;
+    }
+    return Ryaml_skip_digits(str, end, 10) > 0;
+  }
+
+  return 1;
+}
+
+static const char *Ryaml_find_core_tag(const char *value, size_t len)
+{
+  const char *str = value, *end = value + len;
+  size_t int_digits = 0, frac_digits = 0;
+  int sign = 0;
+
+  if (len == 0 || Ryaml_is_one_of(value, len, "~", "null", "Null") ||
+      Ryaml_is_word(value, len, "NULL")) {
+    return "null";
+  }
+  if (Ryaml_is_one_of(value, len, "true", "True", "TRUE")) {
+    return "bool#yes";
+  }
+  if (Ryaml_is_one_of(value, len, "false", "False", "FALSE")) {
+    return "bool#no";
+  }
+  if (Ryaml_is_one_of(value, len, ".nan", ".NaN", ".NAN")) {
+    return "float#nan";
+  }
+  /* Merge keys aren't part of YAML 1.2, but are too common to drop */
+  if (Ryaml_is_word(value, len, "<<")) {
+    return "merge";
+  }
+
+  if (len > 2 && str[0] == '0' && (str[1] == 'o' || str[1] == 'x')) {
+    str += 2;
+    if (Ryaml_skip_digits(&str, end, value[1] == 'o' ? 8 : 16) > 0 && str == end) {
+      return value[1] == 'o' ? "int#oct" : "int#hex";
+    }
+    return "str";
+  }
+
+  if (*str == '-' || *str == '+') {
+    sign = *str;
+    str++;
+  }
+  if (Ryaml_is_one_of(str, end - str, ".inf", ".Inf", ".INF")) {
+    return sign == '-' ? "float#neginf" : "float#inf";
+  }
+
+  int_digits = Ryaml_skip_digits(&str, end, 10);
+  if (str == end) {
+    return int_digits > 0 ? "int" : "str";
+  }
+  if (*str == '.') {
+    str++;
+    frac_digits = Ryaml_skip_digits(&str, end, 10);
+  }
+  if (int_digits + frac_digits > 0 && Ryaml_skip_exponent(&str, end) && str == end) {
+    return "float";
+  }
+
+  return "str";
+}
+
+static const char *Ryaml_find_json_tag(const char *value, size_t len)
+{
+  const char *str = value, *end = value + len;
+  size_t digits = 0;
+
+  if (Ryaml_is_word(value, len, "null")) {
+    return "null";
+  }
+  if (Ryaml_is_word(value, len, "true")) {
+    return "bool#yes";
+  }
+  if (Ryaml_is_word(value, len, "false")) {
+    return "bool#no";
+  }
+
+  if (str < end && *str == '-') {
+    str++;
+  }
+  /* No leading zeros */
+  if (str < end && *str == '0') {
+    str++;
+  }
+  else if ((digits = Ryaml_skip_digits(&str, end, 10)) == 0) {
+    return "str";
+  }
+  if (str == end) {
+    return "int";
+  }
+  if (*str == '.') {
+    str++;
+    Ryaml_skip_digits(&str, end, 10);
+  }
+  if (Ryaml_skip_exponent(&str, end) && str == end) {
+    return "float";
+  }
+
+  return "str";
+}
+
+const char *Ryaml_find_schema_tag(const char *value, size_t len, int schema)
+{
+  switch (schema) {
+    case SCHEMA_CORE:
+      return Ryaml_find_core_tag(value, len);
+    case SCHEMA_JSON:
+      return Ryaml_find_json_tag(value, len);
+    case SCHEMA_FAILSAFE:
+      return "str";
+    default:
+      return Ryaml_find_implicit_tag(value, len);
+  }
+}
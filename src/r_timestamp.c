@@ -0,0 +1,142 @@
+#include "r_ext.h"
+
+/* Parsing of YAML timestamps (http://yaml.org/type/timestamp.html) without
+ * going through the C library's locale and time zone dependent functions */
+
+static int Ryaml_parse_digits(const char **str, const char *end, int min, int max, int *result)
+{
+  const char *start = *str;
+  int n = 0;
+
+  while (*str < end && *str - start < max && **str >= '0' && **str <= '9') {
+    n = n * 10 + (**str - '0');
+    (*str)++;
+  }
+  if (*str - start < min) {
+    return 0;
+  }
+  *result = n;
+
+  return 1;
+}
+
+static int Ryaml_is_leap_year(int year)
+{
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+/* Number of days between 1970-01-01 and the given date in the proleptic
+ * Gregorian calendar */
+static double Ryaml_days_from_civil(int year, int month, int day)
+{
+  int era = 0, year_of_era = 0, day_of_year = 0, day_of_era = 0;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  year_of_era = year - era * 400;
+  day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+  return (double)era * 146097 + day_of_era - 719468;
+}
+
+/* Parse a timestamp of the form YYYY-MM-DD, optionally followed by a time
+ * ("T" or spaces, then hh:mm:ss with optional fraction) and a time zone
+ * ("Z" or +hh, +hh:mm or +hhmm). A date on its own gives the number of days
+ * since 1970-01-01 and sets *is_date; otherwise the result is the number of
+ * seconds since 1970-01-01 00:00:00 UTC. Returns 0 if the value isn't a
+ * valid timestamp. */
+int Ryaml_parse_timestamp(const char *value, size_t len, double *result, int *is_date)
+{
+  static const int days_in_month[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  const char *str = value, *end = value + len;
+  int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0,
+      offset_hour = 0, offset_minute = 0, sign = 0, max_day = 0;
+  double days = 0.0, fraction = 0.0, scale = 0.1;
+
+  if (!Ryaml_parse_digits(&str, end, 4, 4, &year) || str == end || *str++ != '-' ||
+      !Ryaml_parse_digits(&str, end, 1, 2, &month) || str == end || *str++ != '-' ||
+      !Ryaml_parse_digits(&str, end, 1, 2, &day)) {
+    return 0;
+  }
+
+  if (month < 1 || month > 12) {
+    return 0;
+  }
+  max_day = days_in_month[month - 1] + (month == 2 && Ryaml_is_leap_year(year));
+  if (day < 1 || day > max_day) {
+    return 0;
+  }
+  days = Ryaml_days_from_civil(year, month, day);
+
+  if (str == end) {
+    *result = days;
+    *is_date = 1;
+    return 1;
+  }
+
+  if (*str == 'T' || *str == 't') {
+    str++;
+  }
+  else if (*str == ' ' || *str == '\t') {
+    while (str < end && (*str == ' ' || *str == '\t')) {
+      str++;
+    }
+  }
+  else {
+    return 0;
+  }
+
+  if (!Ryaml_parse_digits(&str, end, 1, 2, &hour) || str == end || *str++ != ':' ||
+      !Ryaml_parse_digits(&str, end, 2, 2, &minute) || str == end || *str++ != ':' ||
+      !Ryaml_parse_digits(&str, end, 2, 2, &second)) {
+    return 0;
+  }
+  if (hour > 23 || minute > 59 || second > 60) {
+    return 0;
+  }
+
+  if (str < end && *str == '.') {
+    str++;
+    while (str < end && *str >= '0' && *str <= '9') {
+      fraction += (*str - '0') * scale;
+      scale /= 10;
+      str++;
+    }
+  }
+
+  while (str < end && (*str == ' ' || *str == '\t')) {
+    str++;
+  }
+
+  /* No time zone means UTC */
+  if (str < end) {
+    if (*str == 'Z' && str + 1 == end) {
+      str++;
+    }
+    else if (*str == '+' || *str == '-') {
+      sign = *str++ == '-' ? -1 : 1;
+      if (!Ryaml_parse_digits(&str, end, 1, 2, &offset_hour)) {
+        return 0;
+      }
+      if (str < end && *str == ':') {
+        str++;
+      }
+      if (str < end && !Ryaml_parse_digits(&str, end, 2, 2, &offset_minute)) {
+        return 0;
+      }
+      if (str != end || offset_hour > 23 || offset_minute > 59) {
+        return 0;
+      }
+    }
+    else {
+      return 0;
+    }
+  }
+
+  *result = days * 86400 + hour * 3600 + minute * 60 + second + fraction -
+    sign * (offset_hour * 3600 + offset_minute * 60);
+  *is_date = 0;
+
+  return 1;
+}
@@ -1523,6 +1523,19 @@ typedef enum yaml_emitter_state_e {
     YAML_EMIT_END_STATE
 } yaml_emitter_state_t;
 
+/** The result of analyzing a scalar value for emitting. */
+typedef struct yaml_scalar_analysis_s {
+    /** Does the scalar contain line breaks? */
+    int multiline;
+    /** Can the scalar be expessed in the flow plain style? */
+    int flow_plain_allowed;
+    /** Can the scalar be expressed in the block plain style? */
+    int block_plain_allowed;
+    /** Can the scalar be expressed in the single quoted style? */
+    int single_quoted_allowed;
+    /** Can the scalar be expressed in the literal or folded styles? */
+    int block_allowed;
+} yaml_scalar_analysis_t;
 
 /* This is needed for C++ */
 
@@ -1705,6 +1718,16 @@ typedef struct yaml_emitter_s {
     /** If an explicit document end is required? */
     int open_ended;
 
+    /** Hints for an event emitted without lookahead. */
+    struct {
+        /** The event being emitted, or @c NULL if the event queue is used. */
+        yaml_event_t *event;
+        /** Is the collection started by the event empty? */
+        int empty;
+        /** The caller's analysis of the scalar value, or @c NULL. */
+        const yaml_scalar_analysis_t *analysis;
+    } hint;
+
     /** Anchor analysis. */
     struct {
         /** The anchor value. */
@@ -1932,6 +1955,52 @@ yaml_emitter_set_break(yaml_emitter_t *emitter, yaml_break_t line_break);
 YAML_DECLARE(int)
 yaml_emitter_emit(yaml_emitter_t *emitter, yaml_event_t *event);
 
+/**
+ * Emit an event without accumulating lookahead events.
+ *
+ * The emitter normally queues up to three extra events after a
+ * DOCUMENT-START, SEQUENCE-START or MAPPING-START to find out whether the
+ * collection is empty and whether it can be written as a simple key.  A
+ * caller that already knows this can pass it in @a empty, and the event is
+ * processed at once.  For a SCALAR event, @a analysis may supply the result
+ * of yaml_emitter_analyze_scalar_value() for the value, so that the value is
+ * not scanned again.  If events are still queued from a previous call to
+ * yaml_emitter_emit(), the hints are ignored and the event is queued.
+ *
+ * As with yaml_emitter_emit(), the emitter takes the responsibility for the
+ * event object and destroys its content even if the function fails.
+ *
+ * @param[in,out]   emitter     An emitter object.
+ * @param[in,out]   event       An event object.
+ * @param[in]       empty       If a collection start is followed directly by
+ *                              its end.
+ * @param[in]       analysis    The scalar analysis, or @c NULL.
+ *
+ * @returns @c 1 if the function succeeded, @c 0 on error.
+ */
+
+YAML_DECLARE(int)
+yaml_emitter_emit_hinted(yaml_emitter_t *emitter, yaml_event_t *event,
+        int empty, const yaml_scalar_analysis_t *analysis);
+
+/**
+ * Analyze a scalar value for use with yaml_emitter_emit_hinted().
+ *
+ * The result depends only on the value and on the emitter's unicode setting,
+ * so it may be computed once and reused for every scalar with the same value.
+ *
+ * @param[in,out]   emitter     An emitter object.
+ * @param[in]       value       The scalar value.
+ * @param[in]       length      The length of the scalar value.
+ * @param[out]      analysis    The analysis result.
+ *
+ * @returns @c 1 if the function succeeded, @c 0 on error.
+ */
+
+YAML_DECLARE(int)
+yaml_emitter_analyze_scalar_value(yaml_emitter_t *emitter,
+        yaml_char_t *value, size_t length, yaml_scalar_analysis_t *analysis);
+
 /**
  * Start a YAML stream.
  *